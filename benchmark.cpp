@@ -0,0 +1,413 @@
+#define STB_IMAGE_WRAPPER_IMPLEMENTATION
+#include "image.hpp"
+#undef STB_IMAGE_WRAPPER_IMPLEMENTATION
+
+#define STB_IMAGE_WRAPPER_COLOR_IMPLEMENTATION
+#include "image_color.hpp"
+
+#define STB_IMAGE_WRAPPER_BLUR_IMPLEMENTATION
+#include "image_blur.hpp"
+
+#define STB_IMAGE_WRAPPER_FILTER_IMPLEMENTATION
+#include "image_filter.hpp"
+
+#include <chrono>
+
+// defines macros (round, swap), so it goes after standard headers
+#define STB_IMAGE_WRAPPER_EDIT_IMPLEMENTATION
+#include "image_edit.hpp"
+
+// Runs fn `repeats` times and returns the best time in milliseconds
+template<class F>
+double measure(int repeats, F fn) {
+    double best = 1e30;
+    for (int i=0; i<repeats; i++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+// 1, 2, 4, ... up to number of hardware threads
+std::vector<int> thread_counts() {
+    int max_threads = std::thread::hardware_concurrency();
+    if (max_threads < 1) max_threads = 1;
+
+    std::vector<int> counts;
+    for (int threads=1; threads<max_threads; threads*=2) counts.push_back(threads);
+    counts.push_back(max_threads);
+    return counts;
+}
+
+Image make_test_image(int width, int height, int channels) {
+    Image img(width, height, channels);
+    for (int y=0; y<img.height; y++) {
+        for (int x=0; x<img.width; x++) {
+            uint8_t *p = img.at(x, y);
+            for (int c=0; c<channels; c++) {
+                p[c] = (uint8_t)(x*(c+1) + y*(3-c) + ((x^y) & 31));
+            }
+        }
+    }
+    return img;
+}
+
+void bench_resize(const Image &src, int out_width, int out_height) {
+    std::cout << "resize " << src.width << "x" << src.height << " -> " << out_width << "x" << out_height << std::endl;
+
+    double single = 0;
+    for (int threads: thread_counts()) {
+        ThreadPool pool(threads);
+        Resizer resizer(out_width, out_height);
+        if (threads > 1) resizer.pool = &pool;
+        Image dst(out_width, out_height, src.channels);
+
+        double ms = measure(5, [&]{ resizer.resize(src, dst); });
+        if (threads == 1) single = ms;
+        std::cout << "  threads: " << threads << "\t" << ms << " ms\tspeedup: " << single/ms << std::endl;
+    }
+}
+
+void bench_ycbcr(const Image &src) {
+    std::cout << "rgb -> ycbcr -> rgb " << src.width << "x" << src.height << std::endl;
+
+    Image y(src.width, src.height, 1), cb(src.width, src.height, 1), cr(src.width, src.height, 1);
+    Image dst(src.width, src.height, src.channels);
+
+    double per_pixel = measure(1, [&]{
+        for (int row=0; row<src.height; row++) {
+            auto in = src.row<PixelRGB>(row);
+            auto out = dst.row<PixelRGB>(row);
+            for (int x=0; x<src.width; x++) {
+                ColorYCbCrA ycbcra = ColorRGBA(in[x]);
+                out[x] = (PixelRGB)ColorRGBA(ycbcra);
+            }
+        }
+    });
+    std::cout << "  per pixel ColorYCbCrA:\t" << per_pixel << " ms" << std::endl;
+
+    double bulk = measure(5, [&]{
+        convert_rgb_to_ycbcr(src, {y, cb, cr});
+        convert_ycbcr_to_rgb({y, cb, cr}, dst);
+    });
+    std::cout << "  bulk conversion:\t" << bulk << " ms\tspeedup: " << per_pixel/bulk << std::endl;
+}
+
+// exposure & gain on a whole frame
+void bench_normalized(Image &src) {
+    std::cout << "normalized color math " << src.width << "x" << src.height << std::endl;
+
+    Image dst(src.width, src.height, src.channels);
+    double per_pixel = measure(1, [&]{
+        for (int row=0; row<src.height; row++) {
+            auto in = src.row<PixelRGB>(row);
+            auto out = dst.row<PixelRGB>(row);
+            for (int x=0; x<src.width; x++) {
+                ColorRGBA c = in[x];
+                c *= 1.2;
+                c.b *= 0.9;
+                out[x] = (PixelRGB)c;
+            }
+        }
+    });
+    std::cout << "  per pixel ColorRGBA:\t" << per_pixel << " ms" << std::endl;
+
+    ColorBuffer buffer;
+    double planar = measure(5, [&]{
+        to_normalized(src, buffer);
+        buffer.transform([](ColorRGBAf c) {
+            c *= 1.2f;
+            c.b *= 0.9f;
+            return c;
+        });
+        from_normalized(buffer, dst);
+    });
+    std::cout << "  ColorBuffer:\t" << planar << " ms\tspeedup: " << per_pixel/planar << std::endl;
+}
+
+void bench_blur(const Image &src, float sigma) {
+    std::cout << "blur " << src.width << "x" << src.height << " sigma " << sigma << std::endl;
+
+    Image dst(src.width, src.height, src.channels);
+    GaussianKernel kernel(sigma);
+    double single = 0;
+    for (int threads: thread_counts()) {
+        ThreadPool pool(threads);
+        double gaussian = measure(3, [&]{ gaussian_blur(src, dst, kernel, pool); });
+        double fast = measure(3, [&]{ fast_gaussian_blur(src, dst, sigma, pool); });
+        if (threads == 1) single = fast;
+        std::cout << "  threads: " << threads << "\tgaussian: " << gaussian << " ms\t3 boxes: " << fast << " ms\tspeedup: " << single/fast << std::endl;
+    }
+}
+
+// per pixel at() with clamped coordinates, as filters were written before convolve
+void naive_convolve(const Image &src, Image &dst, const Kernel &kernel) {
+    for (int y=0; y<src.height; y++) {
+        for (int x=0; x<src.width; x++) {
+            for (int c=0; c<src.channels; c++) {
+                float sum = kernel.bias;
+                for (int ky=0; ky<kernel.height; ky++) {
+                    for (int kx=0; kx<kernel.width; kx++) {
+                        int sx = std::clamp(x + kx - kernel.width/2, 0, src.width - 1);
+                        int sy = std::clamp(y + ky - kernel.height/2, 0, src.height - 1);
+                        sum += kernel.weights[ky*kernel.width + kx] * src.at(sx, sy)[c];
+                    }
+                }
+                dst.at(x, y)[c] = (uint8_t)std::clamp((int)lrintf(sum), 0, 255);
+            }
+        }
+    }
+}
+
+void bench_convolve(const Image &src, const std::string &name, const Kernel &kernel) {
+    std::cout << "convolve " << name << " " << kernel.width << "x" << kernel.height << (kernel.is_separable() ? " separable " : " ")
+        << src.width << "x" << src.height << std::endl;
+
+    Image dst(src.width, src.height, src.channels);
+    double naive = measure(1, [&]{ naive_convolve(src, dst, kernel); });
+    std::cout << "  naive at():\t" << naive << " ms" << std::endl;
+
+    for (int threads: thread_counts()) {
+        ThreadPool pool(threads);
+        double ms = measure(3, [&]{ convolve(src, dst, kernel, STBIR_EDGE_CLAMP, pool); });
+        std::cout << "  threads: " << threads << "\t" << ms << " ms\tspeedup: " << naive/ms << std::endl;
+    }
+}
+
+// map-tile pattern: many small filled polygons
+void bench_polygons(Image &img, int count, float radius) {
+    std::cout << count << " hexagons of radius " << radius << " on " << img.width << "x" << img.height << std::endl;
+
+    std::vector<PointF> centers(count);
+    for (int i=0; i<count; i++) {
+        centers[i] = {(float)((int64_t)i*7919 % img.width), (float)((int64_t)i*104729 % img.height)};
+    }
+    PixelRGB clr{40, 160, 90};
+
+    // without a filler a hexagon is composed of a line per row
+    double lines = measure(3, [&]{
+        float half_height = radius*sqrtf(3)/2;
+        for (PointF c: centers) {
+            for (float dy=-half_height; dy<=half_height; dy++) {
+                float half_width = radius - fabsf(dy)/sqrtf(3);
+                draw_line<PixelRGB>(img, c.x - half_width, c.y + dy, c.x + half_width, c.y + dy, clr, 1);
+            }
+        }
+    });
+    std::cout << "  draw_line per row:\t" << lines << " ms" << std::endl;
+
+    double polygons = measure(3, [&]{
+        PointF hexagon[6];
+        for (PointF c: centers) {
+            for (int k=0; k<6; k++) hexagon[k] = {c.x + radius*cosf(k*(float)M_PI/3), c.y + radius*sinf(k*(float)M_PI/3)};
+            fill_polygon<PixelRGB>(img, hexagon, clr);
+        }
+    });
+    std::cout << "  fill_polygon:\t" << polygons << " ms\tspeedup: " << lines/polygons << std::endl;
+}
+
+// overlay pattern: many short annotation lines in all directions, some crossing the image border
+void bench_lines(Image &img, int count, float thickness) {
+    std::cout << count << " lines of thickness " << thickness << " on " << img.width << "x" << img.height << std::endl;
+
+    std::vector<PointF> ends(2*count);
+    for (int i=0; i<count; i++) {
+        float x = (float)((int64_t)i*7919 % (img.width + 64)) - 32;
+        float y = (float)((int64_t)i*104729 % (img.height + 64)) - 32;
+        float angle = i*0.618034f*2*(float)M_PI, length = 8 + i % 56;
+        ends[2*i] = {x, y};
+        ends[2*i + 1] = {x + length*cosf(angle), y + length*sinf(angle)};
+    }
+    PixelRGB clr{230, 40, 40};
+
+    double plots = measure(3, [&]{
+        for (int i=0; i<count; i++) draw_line<PixelRGB>(img, ends[2*i].x, ends[2*i].y, ends[2*i + 1].x, ends[2*i + 1].y, clr, thickness);
+    });
+    std::cout << "  draw_line:\t" << plots << " ms" << std::endl;
+
+    double spans = measure(3, [&]{
+        for (int i=0; i<count; i++) stroke_line<PixelRGB>(img, ends[2*i].x, ends[2*i].y, ends[2*i + 1].x, ends[2*i + 1].y, clr, thickness);
+    });
+    std::cout << "  stroke_line:\t" << spans << " ms\tspeedup: " << plots/spans << std::endl;
+}
+
+// lines of a zoomed-in view: they cross the viewport but mostly lie far out of it
+void bench_clipped_lines(Image &img, int count) {
+    std::cout << count << " lines mostly out of " << img.width << "x" << img.height << std::endl;
+
+    std::vector<PointF> ends(2*count);
+    for (int i=0; i<count; i++) {
+        // through a point of the image, 20 image sizes long
+        float x = (float)((int64_t)i*7919 % img.width), y = (float)((int64_t)i*104729 % img.height);
+        float angle = i*0.618034f*2*(float)M_PI, length = 10.0f*(img.width + img.height);
+        ends[2*i] = {x - length*cosf(angle), y - length*sinf(angle)};
+        ends[2*i + 1] = {x + length*cosf(angle), y + length*sinf(angle)};
+    }
+    PixelRGB clr{40, 40, 230};
+    ClipRect clip(img);
+
+    double clamped = measure(1, [&]{
+        for (int i=0; i<count; i++) draw_line<PixelRGB>(img, ends[2*i].x, ends[2*i].y, ends[2*i + 1].x, ends[2*i + 1].y, clr, 2);
+    });
+    std::cout << "  draw_line:\t" << clamped << " ms" << std::endl;
+
+    double clipped = measure(3, [&]{
+        for (int i=0; i<count; i++) draw_line<PixelRGB>(img, clip, ends[2*i].x, ends[2*i].y, ends[2*i + 1].x, ends[2*i + 1].y, clr, 2);
+    });
+    std::cout << "  draw_line with ClipRect:\t" << clipped << " ms\tspeedup: " << clamped/clipped << std::endl;
+}
+
+// detection markers: rings & discs of all sizes
+void bench_circles(Image &img, int count, float thickness) {
+    std::cout << count << " circles of thickness " << thickness << " on " << img.width << "x" << img.height << std::endl;
+
+    std::vector<PointF> centers(count);
+    for (int i=0; i<count; i++) {
+        centers[i] = {(float)((int64_t)i*7919 % img.width), (float)((int64_t)i*104729 % img.height)};
+    }
+    auto radius = [](int i) { return 4.0f + i % 60; };
+    PixelRGB clr{40, 90, 230};
+    const int segments = 32;
+
+    // without arcs a circle is a polygon of lines
+    double lines = measure(3, [&]{
+        for (int i=0; i<count; i++) {
+            PointF c = centers[i];
+            float r = radius(i);
+            for (int k=0; k<segments; k++) {
+                float a0 = 2*(float)M_PI*k/segments, a1 = 2*(float)M_PI*(k + 1)/segments;
+                draw_line<PixelRGB>(img, c.x + r*cosf(a0), c.y + r*sinf(a0), c.x + r*cosf(a1), c.y + r*sinf(a1), clr, thickness);
+            }
+        }
+    });
+    std::cout << "  draw_line x " << segments << ":\t" << lines << " ms" << std::endl;
+
+    double rings = measure(3, [&]{
+        for (int i=0; i<count; i++) stroke_circle<PixelRGB>(img, centers[i].x, centers[i].y, radius(i), clr, thickness);
+    });
+    std::cout << "  stroke_circle:\t" << rings << " ms\tspeedup: " << lines/rings << std::endl;
+
+    double polygons = measure(3, [&]{
+        std::vector<PointF> polygon(segments);
+        for (int i=0; i<count; i++) {
+            float r = radius(i);
+            for (int k=0; k<segments; k++) polygon[k] = {centers[i].x + r*cosf(2*(float)M_PI*k/segments), centers[i].y + r*sinf(2*(float)M_PI*k/segments)};
+            fill_polygon<PixelRGB>(img, polygon, clr);
+        }
+    });
+    std::cout << "  fill_polygon of " << segments << ":\t" << polygons << " ms" << std::endl;
+
+    double discs = measure(3, [&]{
+        for (int i=0; i<count; i++) fill_circle<PixelRGB>(img, centers[i].x, centers[i].y, radius(i), clr);
+    });
+    std::cout << "  fill_circle:\t" << discs << " ms\tspeedup: " << polygons/discs << std::endl;
+}
+
+// draws shapes right away, with Canvas' interface
+struct ImmediateCanvas {
+    ImageView img;
+
+    void stroke_rect(float x0, float y0, float x1, float y1, PixelRGB clr, float thickness) {
+        PointF rect[4] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}};
+        ::stroke_polyline(img, rect, clr, thickness, 1, true);
+    }
+    void stroke_line(float x0, float y0, float x1, float y1, PixelRGB clr, float thickness) { ::stroke_line(img, x0, y0, x1, y1, clr, thickness); }
+    void fill_circle(float x, float y, float radius, PixelRGB clr, float k) { ::fill_circle(img, x, y, radius, clr, k); }
+    void stroke_polyline(std::span<const PointF> polyline, PixelRGB clr, float thickness) { ::stroke_polyline(img, polyline, clr, thickness); }
+};
+
+// annotation overlay: boxes, leader lines, markers & tracks all over the frame
+template<class CanvasT>
+void annotate(CanvasT &canvas, int width, int height, int count) {
+    for (int i=0; i<count; i++) {
+        float x = (float)((int64_t)i*7919 % width), y = (float)((int64_t)i*104729 % height);
+        float size = 8 + i % 120;
+        PixelRGB clr{(uint8_t)(i*37), (uint8_t)(i*91), (uint8_t)(i*13)};
+        switch (i % 4) {
+            case 0: canvas.stroke_rect(x, y, x + size, y + size*0.6f, clr, 2); break;
+            case 1: canvas.stroke_line(x, y, x + size, y - size/2, clr, 1.5); break;
+            case 2: canvas.fill_circle(x, y, size/16 + 2, clr, 0.8); break;
+            case 3: {
+                PointF track[4] = {{x, y}, {x + size/3, y + size/4}, {x + size*2/3, y + size/5}, {x + size, y + size/2}};
+                canvas.stroke_polyline(track, clr, 2);
+                break;
+            }
+        }
+    }
+}
+
+void bench_canvas(Image &img, int count) {
+    std::cout << "canvas of " << count << " shapes on " << img.width << "x" << img.height << std::endl;
+
+    ImmediateCanvas immediate{img};
+    double serial = measure(3, [&]{ annotate(immediate, img.width, img.height, count); });
+    std::cout << "  one by one:\t" << serial << " ms" << std::endl;
+
+    Canvas<PixelRGB> canvas;
+    for (int threads: thread_counts()) {
+        ThreadPool pool(threads);
+        double ms = measure(3, [&]{
+            canvas.clear();
+            annotate(canvas, img.width, img.height, count);
+            canvas.draw(img, pool);
+        });
+        std::cout << "  threads: " << threads << "\t" << ms << " ms\tspeedup: " << serial/ms << std::endl;
+    }
+}
+
+// per-request pattern: allocate a big image, write it, drop it
+void bench_allocators(int width, int height) {
+    std::cout << "allocate & fill " << width << "x" << height << " rgb image" << std::endl;
+
+    auto request = [&]{
+        Image img(width, height, 3);
+        memset(img.at(0, 0), 0, (size_t)img.stride*img.height);
+    };
+
+    double heap = measure(10, request);
+    std::cout << "  heap:\t" << heap << " ms" << std::endl;
+
+    PoolAllocator pool;
+    double pooled = measure(10, [&]{ AllocatorScope scope(pool); request(); });
+    std::cout << "  pool:\t" << pooled << " ms\tspeedup: " << heap/pooled << std::endl;
+
+    ArenaAllocator arena;
+    double arena_ms = measure(10, [&]{ arena.reset(); AllocatorScope scope(arena); request(); });
+    std::cout << "  arena:\t" << arena_ms << " ms\tspeedup: " << heap/arena_ms << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int width = 8000;
+    int height = 6000;
+    if (argc >= 3) {
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+    }
+
+    Image src = make_test_image(width, height, 3);
+    bench_resize(src, width/2, height/2);
+    bench_resize(src, 1024, 768);
+    bench_ycbcr(src);
+    bench_normalized(src);
+    bench_blur(src, 10);
+    bench_convolve(src, "sharpen", Kernel::sharpen());
+    bench_convolve(src, "sobel x", Kernel::sobel_x());
+    bench_convolve(src, "box", Kernel::box(2));
+    bench_convolve(src, "laplacian of gaussian", Kernel(5, 5, {
+         0,  0, -1,  0,  0,
+         0, -1, -2, -1,  0,
+        -1, -2, 16, -2, -1,
+         0, -1, -2, -1,  0,
+         0,  0, -1,  0,  0}));
+    bench_polygons(src, 100000, 8);
+    bench_lines(src, 200000, 2);
+    bench_clipped_lines(src, 200);
+    bench_circles(src, 20000, 2);
+    bench_canvas(src, 20000);
+    bench_allocators(width, height);
+
+    return 0;
+}
@@ -19,31 +19,27 @@ int main(int argc, char** argv) {
         Image img2 = img;
         std::cout << "Image copied" << std::endl;
 
-        for (int x=0; x<img.width/2; x++){
-            for (int y=0; y<img.height/2; y++) {
-                ColorRGBA clr( *(PixelRGB*)img.at(x, y) );
-                double v = (clr.r + clr.g + clr.b)/3;
-                clr.r = v; clr.g = v; clr.b = v;
-                *(PixelRGB*)img.at(x, y) = (PixelRGB)clr;
-            }
-        }
+        // average of light intensities, not of gamma-encoded values
+        for_each_pixel<PixelRGB>(ImageView(img, 0, 0, img.width/2, img.height/2), [](PixelRGB &pixel) {
+            ColorRGBAf clr = srgb_to_linear(pixel);
+            float v = (clr.r + clr.g + clr.b)/3;
+            pixel = linear_to_srgb<PixelRGB>(ColorRGBAf(v, v, v));
+        });
 
         draw_line<PixelRGB>(img, 0, 0, img.width/2, img.height, PixelRGB{255, 0, 0}, 10);
         add_line_edge<PixelRGB>(img, 0, img.height/2, img.width, img.height/2, PixelRGB{0, 0, 255}, 10, 0.5);
 
         // ColorYCbCrA::Kr = 0.5;
-        for (int x=0; x<img2.width; x++){
-            for (int y=0; y<img2.height; y++) {
-                ColorRGBA rgba = *(PixelRGB*)img2.at(x, y);
-                ColorYCbCrA ycbcra = rgba;
-                // ycbcra.y = 0;
-                // ycbcra.cb *= 0.4;
-                ycbcra.cb = 0;
-                // ycbcra.cr = 0;
-                ColorRGBA final_clr = ycbcra;
-                *(PixelRGB*)img2.at(x, y) = (PixelRGB)final_clr;
-            }
-        }
+        transform<PixelRGB, PixelRGB>(img2, img2, [](const PixelRGB &pixel) {
+            ColorRGBA rgba = pixel;
+            ColorYCbCrA ycbcra = rgba;
+            // ycbcra.y = 0;
+            // ycbcra.cb *= 0.4;
+            ycbcra.cb = 0;
+            // ycbcra.cr = 0;
+            ColorRGBA final_clr = ycbcra;
+            return (PixelRGB)final_clr;
+        });
 
         ColorRGBA rgba = *(PixelRGB*)img.at(50, 50);
         ColorYCbCrA ycbcra = rgba;
@@ -4,9 +4,28 @@
 
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <string>
 #include <assert.h>
 #include <fstream>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <span>
+#include <iterator>
+#include <type_traits>
+#include <filesystem>
+#include <bit>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <optional>
+#include <math.h>
 
 extern "C" {
     #include "stb/stb_image.h"
@@ -16,9 +35,236 @@ extern "C" {
 
 #define TODO(message) static_assert(0 && message);
 
+struct ImageView;
+struct ConstImageView;
+
+// Properties of encoded image read from its header (see Image::probe)
+struct ImageInfo {
+    bool valid = false; // false if data is not recognized as image (or file cannot be read)
+    int width = 0, height = 0;
+    int channels = 0; // channels stored in the file
+    int bits_per_channel = 0; // 8, 16, or 32 for float HDR
+    bool hdr = false;
+};
+
+// Pull-reader interface to decode images from streams without temporary files
+class ImageReader {
+    public:
+    virtual ~ImageReader() = default;
+
+    // fills buffer with up to size bytes, returns number of bytes actually read
+    virtual int read(char *buffer, int size) = 0;
+    // skips n bytes, or 'ungets' last -n bytes if n is negative
+    virtual void skip(int n) = 0;
+    // returns true at the end of data
+    virtual bool eof() = 0;
+};
+
+// ImageReader over std::istream
+class StreamReader: public ImageReader {
+    std::istream &stream;
+    public:
+    StreamReader(std::istream &stream);
+
+    int read(char *buffer, int size) override;
+    void skip(int n) override;
+    bool eof() override;
+};
+
+// Sink for encoded image bytes (see encode_png & co.)
+class ImageWriter {
+    public:
+    virtual ~ImageWriter() = default;
+
+    virtual void write(const void *data, int size) = 0;
+};
+
+// Appends encoded bytes to caller-owned vector
+class VectorWriter: public ImageWriter {
+    std::vector<uint8_t> &buffer;
+    public:
+    VectorWriter(std::vector<uint8_t> &buffer);
+
+    void write(const void *data, int size) override;
+};
+
+// ImageWriter over std::ostream
+class StreamWriter: public ImageWriter {
+    std::ostream &stream;
+    public:
+    StreamWriter(std::ostream &stream);
+
+    void write(const void *data, int size) override;
+};
+
+// Source of image memory. Used for LOCAL images and (through STBI_MALLOC & co.) for everything stb allocates.
+// Images are allocated from ImageAllocator::current(): allocator of innermost AllocatorScope on this thread,
+// otherwise the default one (heap unless changed by set_default).
+class ImageAllocator {
+    public:
+    virtual ~ImageAllocator() = default;
+
+    // alignment is a power of 2, throws std::bad_alloc on failure
+    virtual void* allocate(size_t size, size_t alignment) = 0;
+    virtual void deallocate(void *ptr, size_t size, size_t alignment) = 0;
+    // default allocates new block, copies data & deallocates the old one
+    virtual void* reallocate(void *ptr, size_t old_size, size_t new_size, size_t alignment);
+
+    static ImageAllocator& current();
+    static ImageAllocator& heap();
+    // nullptr restores heap, allocator must outlive all images allocated from it
+    static void set_default(ImageAllocator *allocator);
+};
+
+// Global heap (aligned operator new & delete)
+class HeapAllocator: public ImageAllocator {
+    public:
+    void* allocate(size_t size, size_t alignment) override;
+    void deallocate(void *ptr, size_t size, size_t alignment) override;
+};
+
+// Bump allocator over big blocks. Deallocation is free (only the last allocation is actually rolled back),
+// memory is reclaimed all at once by reset(), which keeps the blocks, so the next request reuses already
+// touched pages. Intended for per-request images: 
+//      arena.reset(); AllocatorScope scope(arena); ...decode, process, encode...
+class ArenaAllocator: public ImageAllocator {
+    struct Block {
+        uint8_t *data;
+        size_t size;
+        size_t used;
+    };
+    std::vector<Block> blocks;
+    size_t current_block = 0;
+    // last allocation (may be rolled back or grown in place)
+    uint8_t *last = nullptr;
+    std::mutex lock;
+
+    public:
+    size_t block_size;
+
+    ArenaAllocator(size_t block_size = 64 << 20);
+    ~ArenaAllocator();
+
+    ArenaAllocator(const ArenaAllocator &other) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator &other) = delete;
+
+    void* allocate(size_t size, size_t alignment) override;
+    void deallocate(void *ptr, size_t size, size_t alignment) override;
+    void* reallocate(void *ptr, size_t old_size, size_t new_size, size_t alignment) override;
+
+    // all allocations become invalid, blocks are kept for reuse
+    void reset();
+    // all allocations become invalid, blocks are freed
+    void release();
+
+    size_t used();
+    size_t capacity();
+};
+
+// Thread-safe pool of buffers in size classes (4 classes per power of 2, so at most 25% is wasted).
+// Freed buffers are kept in per-class free lists and reused, so big images do not go to the heap
+// (and do not page-fault) over and over again. Cache is limited by max_cached bytes.
+class PoolAllocator: public ImageAllocator {
+    std::vector<std::vector<void*>> free_lists;
+    size_t cached_bytes = 0;
+    std::mutex lock;
+
+    public:
+    static const size_t ALIGNMENT = 64;
+    size_t max_cached;
+
+    PoolAllocator(size_t max_cached = SIZE_MAX);
+    ~PoolAllocator();
+
+    PoolAllocator(const PoolAllocator &other) = delete;
+    PoolAllocator& operator=(const PoolAllocator &other) = delete;
+
+    void* allocate(size_t size, size_t alignment) override;
+    void deallocate(void *ptr, size_t size, size_t alignment) override;
+
+    // frees all cached buffers
+    void trim();
+    size_t cached();
+
+    static int size_class(size_t size);
+    static size_t class_size(int size_class);
+};
+
+// Makes allocator current for this thread until the end of scope (scopes may be nested)
+class AllocatorScope {
+    ImageAllocator *previous;
+    public:
+    AllocatorScope(ImageAllocator &allocator);
+    ~AllocatorScope();
+
+    AllocatorScope(const AllocatorScope &other) = delete;
+    AllocatorScope& operator=(const AllocatorScope &other) = delete;
+};
+
+// Forward iterator over pixels of type PixelT, going row by row in memory order (skipping row padding)
+template<class PixelT>
+class PixelIterator {
+    typedef std::conditional_t<std::is_const_v<PixelT>, const uint8_t, uint8_t> Byte;
+    PixelT *ptr, *row_end;
+    int width;
+    size_t stride;
+    public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef std::remove_const_t<PixelT> value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef PixelT* pointer;
+    typedef PixelT& reference;
+
+    PixelIterator(): ptr(nullptr), row_end(nullptr), width(0), stride(0) {}
+    PixelIterator(Byte *row, int width, size_t stride): 
+        ptr((PixelT*)row), row_end((PixelT*)row + width), width(width), stride(stride) {}
+
+    PixelT& operator*() const { return *ptr; }
+    PixelT* operator->() const { return ptr; }
+
+    PixelIterator& operator++() {
+        ++ptr;
+        if (ptr == row_end) {
+            ptr = (PixelT*)((Byte*)(row_end - width) + stride);
+            row_end = ptr + width;
+        }
+        return *this;
+    }
+    PixelIterator operator++(int) {
+        PixelIterator old = *this;
+        ++(*this);
+        return old;
+    }
+
+    bool operator==(const PixelIterator &other) const { return ptr == other.ptr; }
+    bool operator!=(const PixelIterator &other) const { return ptr != other.ptr; }
+};
+
+// All pixels of an image/view, for range-based for:
+//      for (PixelRGB &p: img.pixels<PixelRGB>()) ...
+template<class PixelT>
+class PixelRange {
+    typedef std::conditional_t<std::is_const_v<PixelT>, const uint8_t, uint8_t> Byte;
+    Byte *data;
+    int width, height;
+    size_t stride;
+    public:
+    PixelRange(Byte *data, int width, int height, size_t stride): data(data), width(width), height(height), stride(stride) {}
+
+    PixelIterator<PixelT> begin() const { return PixelIterator<PixelT>(data, width, stride); }
+    PixelIterator<PixelT> end() const { return PixelIterator<PixelT>(data + height*stride, width, stride); }
+};
 
 class Image {
     uint8_t *data = nullptr;
+    int alignment = 0;
+    friend struct ImageView;
+    friend struct ConstImageView;
+
+    void allocate(int alignment);
+    void release();
+    void copy_rows(const ConstImageView &src);
+    void init_loaded(uint8_t *data, int desired_number_of_channels, const std::string &source);
     public:
     typedef enum {
         NONE    = 0,
@@ -26,12 +272,39 @@ class Image {
         STB     = 2,
     } MemoryOwner;
     MemoryOwner owner = NONE;
+    // allocator of LOCAL memory (ImageAllocator::current() at the time of allocation)
+    ImageAllocator *allocator = nullptr;
+
+    // type of one channel value, numeric value is its size in bytes
+    typedef enum {
+        U8      = 1,
+        U16     = 2,
+        F32     = 4,
+    } SampleType;
     
     int width, height, channels;
+    SampleType sample = U8;
+    // distance between rows in bytes (>= width*channels*sample)
+    int stride;
+
+    // size of one pixel in bytes
+    int pixel_size() const { return channels*sample; }
     
-    Image(const char* filepath, int desired_number_of_channels=0);
-    Image(const std::string &filepath, int desired_number_of_channels=0);
-    Image(int width, int height, int channels);
+    // sample selects loader: stbi_load (U8), stbi_load_16 (U16) or stbi_loadf (F32)
+    Image(const char* filepath, int desired_number_of_channels=0, SampleType sample=U8);
+    Image(const std::string &filepath, int desired_number_of_channels=0, SampleType sample=U8);
+    // decodes encoded image (png, jpg, ...) from memory
+    Image(std::span<const uint8_t> encoded, int desired_number_of_channels=0, SampleType sample=U8);
+    // decodes encoded image pulling data from reader
+    Image(ImageReader &reader, int desired_number_of_channels=0, SampleType sample=U8);
+    // alignment=0 means packed rows, otherwise (power of 2, e.g. 32 or 64)
+    // the buffer & every row start at multiples of alignment bytes
+    Image(int width, int height, int channels, int alignment=0);
+    Image(int width, int height, int channels, SampleType sample, int alignment=0);
+    // wraps external memory without owning it (owner is NONE), stride=0 means packed rows
+    Image(uint8_t *data, int width, int height, int channels, int stride=0, SampleType sample=U8);
+    // copies pixels of the view into new image
+    explicit Image(const ConstImageView &view);
     
     ~Image();
     
@@ -46,15 +319,342 @@ class Image {
     
     int save_png(const char* filepath);
     int save_png(const std::string &filepath);
+
+    int save_hdr(const char* filepath);
+    int save_hdr(const std::string &filepath);
     
     uint8_t* at(int x, int y);
     const uint8_t* at(int x, int y) const;
+
+    // Fast access for hot loops: range checks are asserts (only without NDEBUG)
+    uint8_t* at_unchecked(int x, int y) {
+        assert(x >= 0 && x < width && y >= 0 && y < height);
+        return data + (size_t)y*stride + x*pixel_size();
+    }
+    const uint8_t* at_unchecked(int x, int y) const {
+        assert(x >= 0 && x < width && y >= 0 && y < height);
+        return data + (size_t)y*stride + x*pixel_size();
+    }
+
+    template<class PixelT>
+    std::span<PixelT> row(int y) {
+        assert(sizeof(PixelT) == (size_t)pixel_size());
+        assert(y >= 0 && y < height);
+        return std::span<PixelT>((PixelT*)(data + (size_t)y*stride), width);
+    }
+    template<class PixelT>
+    std::span<const PixelT> row(int y) const {
+        assert(sizeof(PixelT) == (size_t)pixel_size());
+        assert(y >= 0 && y < height);
+        return std::span<const PixelT>((const PixelT*)(data + (size_t)y*stride), width);
+    }
+
+    template<class PixelT>
+    PixelRange<PixelT> pixels() {
+        assert(sizeof(PixelT) == (size_t)pixel_size());
+        return PixelRange<PixelT>(data, width, height, stride);
+    }
+    template<class PixelT>
+    PixelRange<const PixelT> pixels() const {
+        assert(sizeof(PixelT) == (size_t)pixel_size());
+        return PixelRange<const PixelT>(data, width, height, stride);
+    }
+
+    Image resized(int width, int height, stbir_filter filter=STBIR_FILTER_DEFAULT, stbir_edge edge=STBIR_EDGE_CLAMP) const;
+
+    // copy with other sample type (see convert_samples)
+    Image converted(SampleType sample) const;
+
+    // Read only headers (no decoding, no pixel memory allocated)
+    static ImageInfo probe(const char* filepath);
+    static ImageInfo probe(const std::string &filepath);
+    static ImageInfo probe(std::span<const uint8_t> encoded);
+    // consumes the beginning of the stream (up to max_header_bytes) until header is recognized
+    static ImageInfo probe(ImageReader &reader, int max_header_bytes=1<<20);
+    // probes files in parallel on the shared pool
+    static std::vector<ImageInfo> probe(const std::vector<std::string> &filepaths);
+    // probes all regular files of directory (not recursive) in parallel
+    static std::vector<std::pair<std::string, ImageInfo>> probe_directory(const std::string &dirpath);
+};
+
+// Non-owning window into image memory.
+// Rows are `stride` bytes apart, so a view may describe a sub-rectangle of a bigger image.
+// Creating views never allocates; the viewed memory must outlive the view.
+struct ImageView {
+    uint8_t *data = nullptr;
+    int width = 0, height = 0, channels = 0;
+    Image::SampleType sample = Image::U8;
+    int stride = 0;
+
+    int pixel_size() const { return channels*sample; }
+
+    ImageView() = default;
+    // stride=0 means rows are packed (width*channels*sample bytes)
+    ImageView(uint8_t *data, int width, int height, int channels, int stride=0, Image::SampleType sample=Image::U8);
+    ImageView(Image &img);
+    ImageView(Image &img, int x, int y, int width, int height);
+
+    ImageView sub(int x, int y, int width, int height) const;
+
+    int save_jpg(const char* filepath, int quality=100) const;
+    int save_jpg(const std::string &filepath, int quality=100) const;
+
+    int save_png(const char* filepath) const;
+    int save_png(const std::string &filepath) const;
+
+    int save_hdr(const char* filepath) const;
+    int save_hdr(const std::string &filepath) const;
+
+    uint8_t* at(int x, int y) const;
+
+    uint8_t* at_unchecked(int x, int y) const {
+        assert(x >= 0 && x < width && y >= 0 && y < height);
+        return data + (size_t)y*stride + x*pixel_size();
+    }
+
+    template<class PixelT>
+    std::span<PixelT> row(int y) const {
+        assert(sizeof(PixelT) == (size_t)pixel_size());
+        assert(y >= 0 && y < height);
+        return std::span<PixelT>((PixelT*)(data + (size_t)y*stride), width);
+    }
+
+    template<class PixelT>
+    PixelRange<PixelT> pixels() const {
+        assert(sizeof(PixelT) == (size_t)pixel_size());
+        return PixelRange<PixelT>(data, width, height, stride);
+    }
+};
+
+struct ConstImageView {
+    const uint8_t *data = nullptr;
+    int width = 0, height = 0, channels = 0;
+    Image::SampleType sample = Image::U8;
+    int stride = 0;
+
+    int pixel_size() const { return channels*sample; }
+
+    ConstImageView() = default;
+    ConstImageView(const uint8_t *data, int width, int height, int channels, int stride=0, Image::SampleType sample=Image::U8);
+    ConstImageView(const Image &img);
+    ConstImageView(const Image &img, int x, int y, int width, int height);
+    ConstImageView(const ImageView &view);
+
+    ConstImageView sub(int x, int y, int width, int height) const;
+
+    int save_jpg(const char* filepath, int quality=100) const;
+    int save_jpg(const std::string &filepath, int quality=100) const;
+
+    int save_png(const char* filepath) const;
+    int save_png(const std::string &filepath) const;
+
+    int save_hdr(const char* filepath) const;
+    int save_hdr(const std::string &filepath) const;
+
+    const uint8_t* at(int x, int y) const;
+
+    const uint8_t* at_unchecked(int x, int y) const {
+        assert(x >= 0 && x < width && y >= 0 && y < height);
+        return data + (size_t)y*stride + x*pixel_size();
+    }
+
+    template<class PixelT>
+    std::span<const PixelT> row(int y) const {
+        assert(sizeof(PixelT) == (size_t)pixel_size());
+        assert(y >= 0 && y < height);
+        return std::span<const PixelT>((const PixelT*)(data + (size_t)y*stride), width);
+    }
+
+    template<class PixelT>
+    PixelRange<const PixelT> pixels() const {
+        assert(sizeof(PixelT) == (size_t)pixel_size());
+        return PixelRange<const PixelT>(data, width, height, stride);
+    }
+};
+
+struct ImagePoolStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t cached_bytes = 0;
+    size_t cached_buffers = 0;
+};
+
+// Recycles buffers of same-sized images: when image from the pool is destroyed, its buffer goes back
+// to the pool and the next image of the same (width, height, channels, sample, stride) takes it
+// without touching the heap. Buffers are kept in small per-thread caches first, then in shared
+// free lists. At most high_water bytes are cached, buffers over it are freed immediately.
+class ImagePool: public ImageAllocator {
+    // free buffers keyed by (size in bytes, alignment) - the same for images with the same key
+    typedef std::map<std::pair<size_t, size_t>, std::vector<void*>> FreeLists;
+    struct ThreadCache {
+        std::mutex lock;
+        FreeLists buffers;
+        bool closed = false;
+    };
+
+    uint64_t id;
+    std::mutex lock;
+    FreeLists buffers;
+    std::vector<std::shared_ptr<ThreadCache>> thread_caches;
+    std::atomic<size_t> hits{0}, misses{0};
+    std::atomic<size_t> cached_bytes{0}, cached_buffers{0};
+
+    ThreadCache& thread_cache();
+    void free_buffers(FreeLists &lists, size_t &keep_bytes);
+    public:
+    size_t high_water;
+    // buffers of one size kept by each thread before going to shared lists
+    int thread_cache_size;
+
+    ImagePool(size_t high_water = SIZE_MAX, int thread_cache_size = 2);
+    ~ImagePool();
+
+    ImagePool(const ImagePool &other) = delete;
+    ImagePool& operator=(const ImagePool &other) = delete;
+
+    // LOCAL image with buffer from the pool (same as Image(width, height, channels, sample, alignment)
+    // inside AllocatorScope of the pool), pixels are not initialized
+    Image acquire(int width, int height, int channels, Image::SampleType sample=Image::U8, int alignment=0);
+
+    void* allocate(size_t size, size_t alignment) override;
+    void deallocate(void *ptr, size_t size, size_t alignment) override;
+
+    // frees cached buffers until at most keep_bytes stay cached
+    void trim(size_t keep_bytes = 0);
+    ImagePoolStats stats() const;
+};
+
+// Pool of worker threads for data-parallel work of the library.
+// Calling thread takes part in the work too, so ThreadPool(n) runs n tasks at once with n-1 workers.
+class ThreadPool {
+    std::vector<std::thread> workers;
+
+    std::mutex run_lock; // only one parallel_for runs at a time
+    std::mutex lock;
+    std::condition_variable wake, done;
+    const std::function<void(int)> *task = nullptr;
+    int task_count = 0;
+    std::atomic<int> next_index{0};
+    int active_workers = 0;
+    unsigned long generation = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+
+    void worker_loop();
+    void run_tasks();
+    public:
+    // threads=0 means std::thread::hardware_concurrency()
+    ThreadPool(int threads=0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &other) = delete;
+    ThreadPool& operator=(const ThreadPool &other) = delete;
+
+    int size() const;
+
+    // Calls fn(i) for every i in [0, count) and blocks until all calls are finished.
+    // Called from inside of a pool task, it runs serially on the current thread.
+    void parallel_for(int count, const std::function<void(int)> &fn);
+
+    // Pool shared by the whole library, sized by hardware_concurrency
+    static ThreadPool& shared();
+};
+
+// Rows are processed in bands of about PARALLEL_BAND_BYTES (so a band of source & destination stays in cache),
+// images smaller than PARALLEL_MIN_BYTES are processed serially on the calling thread
+static const size_t PARALLEL_BAND_BYTES = 128 << 10;
+static const size_t PARALLEL_MIN_BYTES = 256 << 10;
+
+// Splits rows [0, height) of row_bytes each into bands and calls fn(y_begin, y_end) for every band on the pool
+void parallel_for_bands(int height, size_t row_bytes, const std::function<void(int, int)> &fn, ThreadPool &pool = ThreadPool::shared());
+
+// Splits [0, count) into ranges, about 4 per thread, and calls fn(begin, end) for every range on the pool.
+// Work of fewer than PARALLEL_MIN_BYTES bytes runs serially as the single range [0, count).
+void parallel_for_ranges(int count, size_t bytes, const std::function<void(int, int)> &fn, ThreadPool &pool = ThreadPool::shared());
+
+// Encoding to memory & custom sinks. Functions return 0 on failure (as stbi_write_* do).
+// Overloads taking vector clear it and write whole encoded image into it,
+// so the same vector can be reused between calls without new allocations.
+// Formats other than HDR are 8-bit only, images of other sample types are converted first.
+// HDR of integer image is written with values mapped to [0, 1].
+int encode_png(ConstImageView img, ImageWriter &writer);
+int encode_png(ConstImageView img, std::vector<uint8_t> &out);
+int encode_jpg(ConstImageView img, ImageWriter &writer, int quality=100);
+int encode_jpg(ConstImageView img, std::vector<uint8_t> &out, int quality=100);
+int encode_bmp(ConstImageView img, ImageWriter &writer);
+int encode_bmp(ConstImageView img, std::vector<uint8_t> &out);
+int encode_tga(ConstImageView img, ImageWriter &writer);
+int encode_tga(ConstImageView img, std::vector<uint8_t> &out);
+int encode_hdr(ConstImageView img, ImageWriter &writer);
+int encode_hdr(ConstImageView img, std::vector<uint8_t> &out);
+
+// Converts between sample types, src & dst must have the same size & channels.
+// Integers map to [0, 1] in float (8-bit 255 <-> 16-bit 65535 <-> 1.0f), floats are clamped to [0, 1].
+void convert_samples(ConstImageView src, ImageView dst);
+
+// n samples of a row to floats in sample units (0..255 for 8-bit, 0..65535 for 16-bit) & back, integers are rounded & clamped.
+// For filters computing in float, 8-bit rows are converted with SIMD.
+void load_sample_row(const uint8_t *in, Image::SampleType sample, float *out, int n);
+void store_sample_row(const float *in, uint8_t *out, Image::SampleType sample, int n);
+
+// src, or a copy of it when it overlaps dst: filters reading pixels around the ones they write cannot run in place
+ConstImageView unaliased_source(ConstImageView src, ConstImageView dst, std::optional<Image> &copy);
+
+// Wrapper over STBIR_RESIZE with fixed output size.
+// Samplers are built once and reused while input images keep the same size & channels,
+// so resizing a batch of same-sized images to one target size does not rebuild filter kernels.
+class Resizer {
+    STBIR_RESIZE resize_info;
+    bool built = false;
+    int input_width = 0, input_height = 0, input_channels = 0;
+    Image::SampleType input_sample = Image::U8;
+    stbir_filter built_filter;
+    stbir_edge built_edge;
+    ThreadPool *built_pool = nullptr;
+    bool built_srgb = false;
+    int splits = 1;
+
+    void prepare(ConstImageView src, ImageView dst);
+    public:
+    int width, height;
+    stbir_filter filter;
+    stbir_edge edge;
+    // when set, samplers are built with splits and the resize runs on the pool
+    ThreadPool *pool = nullptr;
+    // 8-bit color channels are sRGB: decoded to linear light before filtering & encoded back (alpha stays linear)
+    bool srgb = false;
+
+    Resizer(int width, int height, stbir_filter filter=STBIR_FILTER_DEFAULT, stbir_edge edge=STBIR_EDGE_CLAMP);
+    ~Resizer();
+
+    Resizer(const Resizer &other) = delete;
+    Resizer& operator=(const Resizer &other) = delete;
+
+    Image resize(ConstImageView src);
+    // dst must be width x height with the same number of channels & sample type as src
+    void resize(ConstImageView src, ImageView dst);
 };
 
+// (src*alpha + dst*(255-alpha))/255 rounded to nearest, integers only
+inline uint8_t blend_u8(uint8_t dst, uint8_t src, uint8_t alpha) {
+    int x = src*alpha + dst*(255 - alpha) + 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// 8.8 fixed point scaling (k = 256 is 1.0), saturating
+inline uint8_t scale_u8(uint8_t value, uint16_t k) {
+    int x = (value*k + 128) >> 8;
+    return x > 255 ? 255 : x;
+}
+
 struct PixelGray {
     uint8_t value;
     PixelGray(uint8_t value);
 
+    // integer versions of operator*(float) and of this*(1-k) + other*k (alpha = 255*k)
+    PixelGray scaled(uint16_t k) const { return PixelGray(scale_u8(this->value, k)); }
+    PixelGray blended(const PixelGray &other, uint8_t alpha) const { return PixelGray(blend_u8(this->value, other.value, alpha)); }
+
     PixelGray operator*(float k);
     PixelGray operator/(float k);
 
@@ -71,6 +671,13 @@ struct PixelRGB {
     uint8_t r, g, b;
     PixelRGB(uint8_t r, uint8_t g, uint8_t b);
 
+    PixelRGB scaled(uint16_t k) const { 
+        return PixelRGB(scale_u8(this->r, k), scale_u8(this->g, k), scale_u8(this->b, k)); 
+    }
+    PixelRGB blended(const PixelRGB &other, uint8_t alpha) const {
+        return PixelRGB(blend_u8(this->r, other.r, alpha), blend_u8(this->g, other.g, alpha), blend_u8(this->b, other.b, alpha));
+    }
+
     PixelRGB operator*(float k);
     PixelRGB operator/(float k);
 
@@ -87,243 +694,1918 @@ struct PixelRGBA: public PixelRGB {
     uint8_t a;
     
     PixelRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+
+    // scaled keeps alpha (as operator*), blended blends it as the other channels
+    PixelRGBA scaled(uint16_t k) const { 
+        return PixelRGBA(scale_u8(this->r, k), scale_u8(this->g, k), scale_u8(this->b, k), this->a); 
+    }
+    PixelRGBA blended(const PixelRGBA &other, uint8_t alpha) const {
+        return PixelRGBA(blend_u8(this->r, other.r, alpha), blend_u8(this->g, other.g, alpha), blend_u8(this->b, other.b, alpha), blend_u8(this->a, other.a, alpha));
+    }
     
     PixelRGBA operator*(float k);
     PixelRGBA operator/(float k);
 
-    PixelRGBA operator+(const PixelRGBA& other);
-    PixelRGBA operator-(const PixelRGBA& other);
+    PixelRGBA operator+(const PixelRGBA& other);
+    PixelRGBA operator-(const PixelRGBA& other);
+
+    PixelRGBA& operator+=(const PixelRGBA& other);
+    PixelRGBA& operator-=(const PixelRGBA& other);
+};
+PixelRGBA operator*(float k, PixelRGBA& pix);
+std::ostream& operator<<(std::ostream& os, const PixelRGBA& p);
+
+// Pixels of 16-bit (Image::U16) and float (Image::F32) images
+struct PixelGray16 {
+    uint16_t value;
+    PixelGray16(uint16_t value);
+};
+std::ostream& operator<<(std::ostream& os, const PixelGray16& p);
+
+struct PixelRGB16 {
+    uint16_t r, g, b;
+    PixelRGB16(uint16_t r, uint16_t g, uint16_t b);
+};
+std::ostream& operator<<(std::ostream& os, const PixelRGB16& p);
+
+struct PixelRGBA16: public PixelRGB16 {
+    uint16_t a;
+    PixelRGBA16(uint16_t r, uint16_t g, uint16_t b, uint16_t a);
+};
+std::ostream& operator<<(std::ostream& os, const PixelRGBA16& p);
+
+struct PixelGrayF {
+    float value;
+    PixelGrayF(float value);
+};
+std::ostream& operator<<(std::ostream& os, const PixelGrayF& p);
+
+struct PixelRGBF {
+    float r, g, b;
+    PixelRGBF(float r, float g, float b);
+};
+std::ostream& operator<<(std::ostream& os, const PixelRGBF& p);
+
+struct PixelRGBAF: public PixelRGBF {
+    float a;
+    PixelRGBAF(float r, float g, float b, float a);
+};
+std::ostream& operator<<(std::ostream& os, const PixelRGBAF& p);
+
+// 3x3 matrix of an 8-bit conversion in fixed point of the bulk conversions (see convert_rgb_to_ycbcr):
+// bytes are shifted to v<<7 & multiplied by Q13 coefficients keeping the high 16 bits, so terms have 4 fractional bits,
+// offset (Cb & Cr shift by 128 & rounding) is in the same units:
+//      out[k] = clamp((offset[k] + sum of ((in[j] << 7)*m[k][j] >> 16)) >> 4, 0, 255)
+struct YCbCrFixed {
+    int32_t m[3][3] = {};
+    int32_t offset[3] = {};
+    // coefficients & sums fit 16 bits, so SIMD kernels can use them (unusual Kr/Kb may give ones that do not)
+    bool simd = false;
+
+    constexpr YCbCrFixed() = default;
+    constexpr YCbCrFixed(const double (&matrix)[3][3], const double (&shift)[3]) {
+        auto magnitude = [](double v) { return v < 0 ? -v : v; };
+        auto to_fixed = [](double v) { return (int32_t)(v + (v >= 0 ? 0.5 : -0.5)); };
+        this->simd = true;
+        for (int k=0; k<3; k++) {
+            double sum = magnitude(shift[k]);
+            for (int j=0; j<3; j++) {
+                this->m[k][j] = to_fixed(matrix[k][j]*8192);
+                if (magnitude(matrix[k][j]) >= 3.99) this->simd = false;
+                sum += 255*magnitude(matrix[k][j]);
+            }
+            this->offset[k] = to_fixed(shift[k]*16 + 8);
+            if (sum >= 2000) this->simd = false;
+        }
+    }
+
+    constexpr void apply(uint8_t a, uint8_t b, uint8_t c, uint8_t out[3]) const {
+        const int in[3] = {a, b, c};
+        for (int k=0; k<3; k++) {
+            int v = this->offset[k];
+            for (int j=0; j<3; j++) v += (int)(((int64_t)(in[j] << 7)*this->m[k][j]) >> 16);
+            v >>= 4;
+            out[k] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+    }
+};
+
+// Immutable definition of YCbCr: Kr & Kb with conversion matrices derived from them at construction
+// (at compile time for constexpr spaces). Unlike ColorYCbCrA::Kr & Kb it is passed to every conversion,
+// so threads may convert with different spaces at once.
+// Matrices work on normalized values, Cb & Cr in [-0.5, 0.5]:
+//      (y, cb, cr) = to_ycbcr * (r, g, b)      (r, g, b) = to_rgb * (y, cb, cr)
+class YCbCrSpace {
+    typedef double Matrix[3][3];
+
+    double kr = 0, kb = 0;
+    Matrix ycbcr = {};
+    Matrix rgb = {};
+    // the same on 8-bit values (Cb & Cr shifted by 128), used by to_*_u8 & the bulk conversions
+    YCbCrFixed ycbcr_fixed, rgb_fixed;
+    public:
+    constexpr YCbCrSpace(double Kr, double Kb): kr(Kr), kb(Kb) {
+        double Kg = 1 - Kr - Kb;
+        double m[3][3] = {
+            { Kr,                   Kg,                 Kb },
+            { -Kr/(2*(1-Kb)),       -Kg/(2*(1-Kb)),     0.5 },
+            { 0.5,                  -Kg/(2*(1-Kr)),     -Kb/(2*(1-Kr)) },
+        };
+        double r_cr = 2*(1-Kr);
+        double b_cb = 2*(1-Kb);
+        double inv[3][3] = {
+            { 1,    0,              r_cr },
+            { 1,    -Kb*b_cb/Kg,    -Kr*r_cr/Kg },
+            { 1,    b_cb,           0 },
+        };
+        double rgb_shift[3] = {};
+        for (int i=0; i<3; i++) {
+            for (int j=0; j<3; j++) {
+                this->ycbcr[i][j] = m[i][j];
+                this->rgb[i][j] = inv[i][j];
+            }
+            rgb_shift[i] = -128*(inv[i][1] + inv[i][2]);
+        }
+        const double ycbcr_shift[3] = {0, 128, 128};
+        this->ycbcr_fixed = YCbCrFixed(m, ycbcr_shift);
+        this->rgb_fixed = YCbCrFixed(inv, rgb_shift);
+    }
+
+    constexpr double Kr() const { return this->kr; }
+    constexpr double Kb() const { return this->kb; }
+    constexpr const Matrix& to_ycbcr() const { return this->ycbcr; }
+    constexpr const Matrix& to_rgb() const { return this->rgb; }
+    constexpr const YCbCrFixed& to_ycbcr_fixed() const { return this->ycbcr_fixed; }
+    constexpr const YCbCrFixed& to_rgb_fixed() const { return this->rgb_fixed; }
+
+    // 8-bit conversions (Cb & Cr shifted by 128, as in JPEG) in fixed point only, same as the bulk conversions
+    constexpr void to_ycbcr_u8(uint8_t r, uint8_t g, uint8_t b, uint8_t out[3]) const {
+        this->ycbcr_fixed.apply(r, g, b, out);
+    }
+    constexpr void to_rgb_u8(uint8_t y, uint8_t cb, uint8_t cr, uint8_t out[3]) const {
+        this->rgb_fixed.apply(y, cb, cr, out);
+    }
+
+    static const YCbCrSpace BT601;
+    static const YCbCrSpace BT709;
+    static const YCbCrSpace BT2020;
+
+    // snapshot of ColorYCbCrA::Kr & ColorYCbCrA::Kb
+    static YCbCrSpace current();
+};
+
+inline constexpr YCbCrSpace YCbCrSpace::BT601(0.299, 0.114);
+inline constexpr YCbCrSpace YCbCrSpace::BT709(0.2126, 0.0722);
+inline constexpr YCbCrSpace YCbCrSpace::BT2020(0.2627, 0.0593);
+
+struct ColorRGBA;
+struct ColorYCbCrA; 
+
+struct ColorRGBA {
+    double r, g, b;
+    double a = 1;
+
+    ColorRGBA();
+    ColorRGBA(double r, double g, double b);
+    ColorRGBA(double r, double g, double b, double a);
+    ColorRGBA(const PixelGray& p);
+    ColorRGBA(const PixelRGB& rgb);
+    ColorRGBA(const PixelRGBA& rgba);
+    ColorRGBA(const ColorYCbCrA& ycbcra);
+    ColorRGBA(const ColorYCbCrA& ycbcra, const YCbCrSpace& space);
+
+    ColorRGBA operator*(double k);
+    ColorRGBA operator/(double k);
+
+    ColorRGBA operator+(const ColorRGBA& other);
+    ColorRGBA operator-(const ColorRGBA& other);
+
+    ColorRGBA& operator*=(double k);
+    ColorRGBA& operator+=(const ColorRGBA& other);
+    ColorRGBA& operator-=(const ColorRGBA& other);
+
+    explicit operator PixelGray() const;
+    explicit operator PixelRGB() const;
+    explicit operator PixelRGBA() const;
+
+    explicit operator ColorYCbCrA() const;
+};
+ColorRGBA operator*(double k, const ColorRGBA& pix);
+std::ostream& operator<<(std::ostream& os, const ColorRGBA& p);
+
+struct ColorYCbCrA {
+    // Kr & Kb MAY! be edited, and it will affect forward and backward conversions
+    static double Kr; 
+    static double Kb;
+
+    double y, cb, cr;
+    double a = 1;
+
+    ColorYCbCrA();
+    ColorYCbCrA(double y, double cb, double cr);
+    ColorYCbCrA(double y, double cb, double cr, double a);
+    ColorYCbCrA(const ColorRGBA& clr);
+    ColorYCbCrA(const ColorRGBA& clr, const YCbCrSpace& space);
+
+    ColorYCbCrA operator*(double k);
+    ColorYCbCrA operator/(double k);
+
+    ColorYCbCrA operator+(const ColorYCbCrA& other);
+    ColorYCbCrA operator-(const ColorYCbCrA& other);
+
+    ColorYCbCrA& operator*=(double k);
+    ColorYCbCrA& operator+=(const ColorYCbCrA& other);
+    ColorYCbCrA& operator-=(const ColorYCbCrA& other);
+
+    explicit operator ColorRGBA() const;
+};
+ColorYCbCrA operator*(double k, const ColorYCbCrA& pix);
+std::ostream& operator<<(std::ostream& os, const ColorYCbCrA& p);
+
+// Float counterparts of ColorRGBA & ColorYCbCrA: 16 bytes per color and inline operators,
+// so loops over them can be vectorized. Arithmetic is the same (alpha of sum is the average),
+// alpha is kept by YCbCr conversions, conversions to pixels clamp to [0, 1] and round to nearest.
+struct ColorYCbCrAf;
+
+// written as min/max so that it vectorizes, NaN ends up as 0
+inline uint8_t normalized_to_u8(float v) {
+    v = v > 0 ? v : 0;
+    v = v < 1 ? v : 1;
+    return (uint8_t)(int)(v*255 + 0.5f);
+}
+
+struct ColorRGBAf {
+    float r = 0, g = 0, b = 0;
+    float a = 1;
+
+    ColorRGBAf() = default;
+    ColorRGBAf(float r, float g, float b, float a = 1): r(r), g(g), b(b), a(a) {}
+    ColorRGBAf(const PixelGray& p): r(p.value/255.0f), g(p.value/255.0f), b(p.value/255.0f) {}
+    ColorRGBAf(const PixelRGB& p): r(p.r/255.0f), g(p.g/255.0f), b(p.b/255.0f) {}
+    ColorRGBAf(const PixelRGBA& p): r(p.r/255.0f), g(p.g/255.0f), b(p.b/255.0f), a(p.a/255.0f) {}
+    explicit ColorRGBAf(const ColorRGBA& c): r(c.r), g(c.g), b(c.b), a(c.a) {}
+    inline ColorRGBAf(const ColorYCbCrAf& ycbcra);
+    inline ColorRGBAf(const ColorYCbCrAf& ycbcra, const YCbCrSpace& space);
+
+    ColorRGBAf operator*(float k) const { return ColorRGBAf(r*k, g*k, b*k, a); }
+    ColorRGBAf operator/(float k) const { return ColorRGBAf(r/k, g/k, b/k, a); }
+
+    ColorRGBAf operator+(const ColorRGBAf& o) const { return ColorRGBAf(r + o.r, g + o.g, b + o.b, (a + o.a)/2); }
+    ColorRGBAf operator-(const ColorRGBAf& o) const { return ColorRGBAf(r - o.r, g - o.g, b - o.b, (a + o.a)/2); }
+
+    ColorRGBAf& operator*=(float k) { r *= k; g *= k; b *= k; return *this; }
+    ColorRGBAf& operator+=(const ColorRGBAf& o) { r += o.r; g += o.g; b += o.b; return *this; }
+    ColorRGBAf& operator-=(const ColorRGBAf& o) { r -= o.r; g -= o.g; b -= o.b; return *this; }
+
+    explicit operator PixelGray() const { return PixelGray(normalized_to_u8((r + g + b)/3)); }
+    explicit operator PixelRGB() const { return PixelRGB(normalized_to_u8(r), normalized_to_u8(g), normalized_to_u8(b)); }
+    explicit operator PixelRGBA() const { return PixelRGBA(normalized_to_u8(r), normalized_to_u8(g), normalized_to_u8(b), normalized_to_u8(a)); }
+    explicit operator ColorRGBA() const { return ColorRGBA(r, g, b, a); }
+
+    inline explicit operator ColorYCbCrAf() const;
+};
+inline ColorRGBAf operator*(float k, const ColorRGBAf& c) { return c*k; }
+std::ostream& operator<<(std::ostream& os, const ColorRGBAf& p);
+
+// conversions without YCbCrSpace use ColorYCbCrA::Kr & ColorYCbCrA::Kb
+struct ColorYCbCrAf {
+    float y = 0, cb = 0, cr = 0;
+    float a = 1;
+
+    ColorYCbCrAf() = default;
+    ColorYCbCrAf(float y, float cb, float cr, float a = 1): y(y), cb(cb), cr(cr), a(a) {}
+    ColorYCbCrAf(const ColorRGBAf& c) {
+        float Kr = ColorYCbCrA::Kr, Kb = ColorYCbCrA::Kb;
+        y = Kr*c.r + (1-Kr-Kb)*c.g + Kb*c.b;
+        cb = (c.b - y)/(2*(1 - Kb));
+        cr = (c.r - y)/(2*(1 - Kr));
+        a = c.a;
+    }
+    ColorYCbCrAf(const ColorRGBAf& c, const YCbCrSpace& space) {
+        const double (*m)[3] = space.to_ycbcr();
+        y = (float)m[0][0]*c.r + (float)m[0][1]*c.g + (float)m[0][2]*c.b;
+        cb = (float)m[1][0]*c.r + (float)m[1][1]*c.g + (float)m[1][2]*c.b;
+        cr = (float)m[2][0]*c.r + (float)m[2][1]*c.g + (float)m[2][2]*c.b;
+        a = c.a;
+    }
+    explicit ColorYCbCrAf(const ColorYCbCrA& c): y(c.y), cb(c.cb), cr(c.cr), a(c.a) {}
+
+    ColorYCbCrAf operator*(float k) const { return ColorYCbCrAf(y*k, cb*k, cr*k, a); }
+    ColorYCbCrAf operator/(float k) const { return ColorYCbCrAf(y/k, cb/k, cr/k, a); }
+
+    ColorYCbCrAf operator+(const ColorYCbCrAf& o) const { return ColorYCbCrAf(y + o.y, cb + o.cb, cr + o.cr, (a + o.a)/2); }
+    ColorYCbCrAf operator-(const ColorYCbCrAf& o) const { return ColorYCbCrAf(y - o.y, cb - o.cb, cr - o.cr, (a + o.a)/2); }
+
+    ColorYCbCrAf& operator*=(float k) { y *= k; cb *= k; cr *= k; return *this; }
+    ColorYCbCrAf& operator+=(const ColorYCbCrAf& o) { y += o.y; cb += o.cb; cr += o.cr; return *this; }
+    ColorYCbCrAf& operator-=(const ColorYCbCrAf& o) { y -= o.y; cb -= o.cb; cr -= o.cr; return *this; }
+
+    explicit operator ColorRGBAf() const { return ColorRGBAf(*this); }
+    explicit operator ColorYCbCrA() const { return ColorYCbCrA(y, cb, cr, a); }
+};
+inline ColorYCbCrAf operator*(float k, const ColorYCbCrAf& c) { return c*k; }
+std::ostream& operator<<(std::ostream& os, const ColorYCbCrAf& p);
+
+inline ColorRGBAf::ColorRGBAf(const ColorYCbCrAf& c) {
+    float Kr = ColorYCbCrA::Kr, Kb = ColorYCbCrA::Kb;
+    r = c.y + 2*(1-Kr)*c.cr;
+    b = c.y + 2*(1-Kb)*c.cb;
+    g = (c.y - Kr*r - Kb*b)/(1 - Kr - Kb);
+    a = c.a;
+}
+
+inline ColorRGBAf::ColorRGBAf(const ColorYCbCrAf& c, const YCbCrSpace& space) {
+    const double (*m)[3] = space.to_rgb();
+    r = c.y + (float)m[0][2]*c.cr;
+    g = c.y + (float)m[1][1]*c.cb + (float)m[1][2]*c.cr;
+    b = c.y + (float)m[2][1]*c.cb;
+    a = c.a;
+}
+
+inline ColorRGBAf::operator ColorYCbCrAf() const {
+    return ColorYCbCrAf(*this);
+}
+
+// sRGB transfer function in tables, filled once at startup.
+// Encoding looks up the code of the 1/4095 step below the value and corrects it by one threshold compare,
+// so it gives the same code as rounding the exact sRGB curve.
+struct SRGBTables {
+    float decode[256];          // 8-bit sRGB -> linear light in [0, 1]
+    uint8_t encode[4096];       // code of linear value i/4095
+    float threshold[257];       // smallest linear value of code k (midpoint between decoded k-1 & k), threshold[256] = 2
+};
+extern const SRGBTables srgb_tables;
+
+inline float srgb_to_linear(uint8_t v) {
+    return srgb_tables.decode[v];
+}
+
+// clamped to [0, 1], NaN gives 0
+inline uint8_t linear_to_srgb(float v) {
+    v = v > 0 ? v : 0;
+    v = v < 1 ? v : 1;
+    int code = srgb_tables.encode[(int)(v*4095)];
+    return code + (v >= srgb_tables.threshold[code + 1]);
+}
+
+// Pixels to linear-light colors and back, alpha is not gamma encoded & maps as in ColorRGBAf
+inline ColorRGBAf srgb_to_linear(const PixelGray& p) {
+    float v = srgb_to_linear(p.value);
+    return ColorRGBAf(v, v, v);
+}
+inline ColorRGBAf srgb_to_linear(const PixelRGB& p) {
+    return ColorRGBAf(srgb_to_linear(p.r), srgb_to_linear(p.g), srgb_to_linear(p.b));
+}
+inline ColorRGBAf srgb_to_linear(const PixelRGBA& p) {
+    return ColorRGBAf(srgb_to_linear(p.r), srgb_to_linear(p.g), srgb_to_linear(p.b), p.a/255.0f);
+}
+
+template<class PixelT>
+inline PixelT linear_to_srgb(const ColorRGBAf& c);
+template<>
+inline PixelGray linear_to_srgb<PixelGray>(const ColorRGBAf& c) {
+    return PixelGray(linear_to_srgb((c.r + c.g + c.b)/3));
+}
+template<>
+inline PixelRGB linear_to_srgb<PixelRGB>(const ColorRGBAf& c) {
+    return PixelRGB(linear_to_srgb(c.r), linear_to_srgb(c.g), linear_to_srgb(c.b));
+}
+template<>
+inline PixelRGBA linear_to_srgb<PixelRGBA>(const ColorRGBAf& c) {
+    return PixelRGBA(linear_to_srgb(c.r), linear_to_srgb(c.g), linear_to_srgb(c.b), normalized_to_u8(c.a));
+}
+
+// Compile-time description of pixel structures
+template<class PixelT> struct PixelTraits;
+template<> struct PixelTraits<PixelGray>   { static constexpr int channels = 1; static constexpr Image::SampleType sample = Image::U8; };
+template<> struct PixelTraits<PixelRGB>    { static constexpr int channels = 3; static constexpr Image::SampleType sample = Image::U8; };
+template<> struct PixelTraits<PixelRGBA>   { static constexpr int channels = 4; static constexpr Image::SampleType sample = Image::U8; };
+template<> struct PixelTraits<PixelGray16> { static constexpr int channels = 1; static constexpr Image::SampleType sample = Image::U16; };
+template<> struct PixelTraits<PixelRGB16>  { static constexpr int channels = 3; static constexpr Image::SampleType sample = Image::U16; };
+template<> struct PixelTraits<PixelRGBA16> { static constexpr int channels = 4; static constexpr Image::SampleType sample = Image::U16; };
+template<> struct PixelTraits<PixelGrayF>  { static constexpr int channels = 1; static constexpr Image::SampleType sample = Image::F32; };
+template<> struct PixelTraits<PixelRGBF>   { static constexpr int channels = 3; static constexpr Image::SampleType sample = Image::F32; };
+template<> struct PixelTraits<PixelRGBAF>  { static constexpr int channels = 4; static constexpr Image::SampleType sample = Image::F32; };
+
+// View with pixel format known at compile time. PixelT may be const (view of const pixels).
+template<class PixelT>
+struct ImageViewT {
+    typedef std::remove_const_t<PixelT> Pixel;
+    typedef std::conditional_t<std::is_const_v<PixelT>, const uint8_t, uint8_t> Byte;
+    typedef std::conditional_t<std::is_const_v<PixelT>, ConstImageView, ImageView> View;
+    static constexpr int channels = PixelTraits<Pixel>::channels;
+    static constexpr Image::SampleType sample = PixelTraits<Pixel>::sample;
+
+    Byte *data = nullptr;
+    int width = 0, height = 0;
+    int stride = 0;
+
+    ImageViewT() = default;
+    ImageViewT(Byte *data, int width, int height, int stride=0): 
+        data(data), width(width), height(height), stride(stride ? stride : width*(int)sizeof(Pixel)) {}
+    // throws std::invalid_argument if number of channels or sample type of view does not match PixelT
+    ImageViewT(const View &view): data(view.data), width(view.width), height(view.height), stride(view.stride) {
+        if (view.channels != channels) {
+            throw std::invalid_argument("Cannot view image of " + std::to_string(view.channels) + " channels as " + std::to_string(channels) + " channel pixels");
+        }
+        if (view.sample != sample) {
+            throw std::invalid_argument("Cannot view image of " + std::to_string(view.sample) + " byte samples as " + std::to_string(sample) + " byte sample pixels");
+        }
+    }
+
+    operator View() const { return View(data, width, height, channels, stride, sample); }
+
+    // range checks are asserts (only without NDEBUG)
+    PixelT& at(int x, int y) const {
+        assert(x >= 0 && x < width && y >= 0 && y < height);
+        return *(PixelT*)(data + (size_t)y*stride + x*sizeof(Pixel));
+    }
+    std::span<PixelT> row(int y) const {
+        assert(y >= 0 && y < height);
+        return std::span<PixelT>((PixelT*)(data + (size_t)y*stride), width);
+    }
+    PixelRange<PixelT> pixels() const {
+        return PixelRange<PixelT>(data, width, height, stride);
+    }
+
+    ImageViewT sub(int x, int y, int width, int height) const {
+        return ImageViewT(View(*this).sub(x, y, width, height));
+    }
+};
+
+// Image with pixel format known at compile time.
+// It is still an Image (the type-erased form), so it can be passed to any function taking Image or views.
+template<class PixelT>
+class ImageT: public Image {
+    public:
+    static constexpr int channels = PixelTraits<PixelT>::channels;
+    static constexpr SampleType sample = PixelTraits<PixelT>::sample;
+
+    ImageT(int width, int height, int alignment=0): Image(width, height, channels, sample, alignment) {}
+    ImageT(const char* filepath): Image(filepath, channels, sample) {}
+    ImageT(const std::string &filepath): Image(filepath, channels, sample) {}
+    // takes over memory of img, throws std::invalid_argument if number of channels or sample type does not match PixelT
+    explicit ImageT(Image &&img): Image(std::move(img)) {
+        if (Image::channels != channels) {
+            throw std::invalid_argument("Cannot use image of " + std::to_string(Image::channels) + " channels as " + std::to_string(channels) + " channel image");
+        }
+        if (Image::sample != sample) {
+            throw std::invalid_argument("Cannot use image of " + std::to_string(Image::sample) + " byte samples as " + std::to_string(sample) + " byte sample image");
+        }
+    }
+
+    ImageViewT<PixelT> view() { return ImageViewT<PixelT>(ImageView(*this)); }
+    ImageViewT<const PixelT> view() const { return ImageViewT<const PixelT>(ConstImageView(*this)); }
+
+    PixelT& at(int x, int y) { return *(PixelT*)this->at_unchecked(x, y); }
+    const PixelT& at(int x, int y) const { return *(const PixelT*)this->at_unchecked(x, y); }
+
+    std::span<PixelT> row(int y) { return Image::row<PixelT>(y); }
+    std::span<const PixelT> row(int y) const { return Image::row<PixelT>(y); }
+
+    PixelRange<PixelT> pixels() { return Image::pixels<PixelT>(); }
+    PixelRange<const PixelT> pixels() const { return Image::pixels<PixelT>(); }
+};
+
+// Calls f with ImageViewT of pixel type matching number of channels & sample type of img,
+// so f (usually generic lambda) is instantiated once per pixel format instead of branching per pixel:
+//      visit(img, [](auto view) { for (auto &p: view.pixels()) ... });
+template<class F>
+decltype(auto) visit(ImageView img, F &&f) {
+    switch (img.channels*8 + img.sample) {
+    case 1*8 + Image::U8:  return f(ImageViewT<PixelGray>(img));
+    case 3*8 + Image::U8:  return f(ImageViewT<PixelRGB>(img));
+    case 4*8 + Image::U8:  return f(ImageViewT<PixelRGBA>(img));
+    case 1*8 + Image::U16: return f(ImageViewT<PixelGray16>(img));
+    case 3*8 + Image::U16: return f(ImageViewT<PixelRGB16>(img));
+    case 4*8 + Image::U16: return f(ImageViewT<PixelRGBA16>(img));
+    case 1*8 + Image::F32: return f(ImageViewT<PixelGrayF>(img));
+    case 3*8 + Image::F32: return f(ImageViewT<PixelRGBF>(img));
+    case 4*8 + Image::F32: return f(ImageViewT<PixelRGBAF>(img));
+    default:
+        throw std::invalid_argument("No pixel type for " + std::to_string(img.channels) + " channels");
+    }
+}
+
+template<class F>
+decltype(auto) visit(ConstImageView img, F &&f) {
+    switch (img.channels*8 + img.sample) {
+    case 1*8 + Image::U8:  return f(ImageViewT<const PixelGray>(img));
+    case 3*8 + Image::U8:  return f(ImageViewT<const PixelRGB>(img));
+    case 4*8 + Image::U8:  return f(ImageViewT<const PixelRGBA>(img));
+    case 1*8 + Image::U16: return f(ImageViewT<const PixelGray16>(img));
+    case 3*8 + Image::U16: return f(ImageViewT<const PixelRGB16>(img));
+    case 4*8 + Image::U16: return f(ImageViewT<const PixelRGBA16>(img));
+    case 1*8 + Image::F32: return f(ImageViewT<const PixelGrayF>(img));
+    case 3*8 + Image::F32: return f(ImageViewT<const PixelRGBF>(img));
+    case 4*8 + Image::F32: return f(ImageViewT<const PixelRGBAF>(img));
+    default:
+        throw std::invalid_argument("No pixel type for " + std::to_string(img.channels) + " channels");
+    }
+}
+
+template<class F>
+decltype(auto) visit(Image &img, F &&f) {
+    return visit(ImageView(img), std::forward<F>(f));
+}
+
+template<class F>
+decltype(auto) visit(const Image &img, F &&f) {
+    return visit(ConstImageView(img), std::forward<F>(f));
+}
+
+// Calls f(y) for every row of img, rows are split into bands running in parallel (see parallel_for_bands).
+// f must be safe to call concurrently for different rows.
+template<class F>
+void parallel_for_rows(ConstImageView img, F &&f, ThreadPool &pool = ThreadPool::shared()) {
+    parallel_for_bands(img.height, (size_t)img.width*img.pixel_size(), [&](int y_begin, int y_end) {
+        for (int y=y_begin; y<y_end; y++) f(y);
+    }, pool);
+}
+
+// Calls f(PixelT&) for every pixel of img in parallel
+template<class PixelT, class F>
+void for_each_pixel(ImageView img, F &&f, ThreadPool &pool = ThreadPool::shared()) {
+    ImageViewT<PixelT> view(img);
+    parallel_for_rows(img, [&](int y) {
+        for (PixelT &pixel: view.row(y)) f(pixel);
+    }, pool);
+}
+
+// dst(x, y) = f(src(x, y)) for every pixel in parallel. src & dst must have the same size (may be the same image),
+// throws std::invalid_argument if they do not or if their formats do not match SrcPixel & DstPixel
+template<class SrcPixel, class DstPixel, class F>
+void transform(ConstImageView src, ImageView dst, F &&f, ThreadPool &pool = ThreadPool::shared()) {
+    if (src.width != dst.width || src.height != dst.height) {
+        throw std::invalid_argument("Transform destination does not match source size");
+    }
+    ImageViewT<const SrcPixel> in(src);
+    ImageViewT<DstPixel> out(dst);
+    parallel_for_bands(src.height, (size_t)src.width*(sizeof(SrcPixel) + sizeof(DstPixel)), [&](int y_begin, int y_end) {
+        for (int y=y_begin; y<y_end; y++) {
+            const SrcPixel *s = in.row(y).data();
+            DstPixel *d = out.row(y).data();
+            for (int x=0; x<src.width; x++) d[x] = f(s[x]);
+        }
+    }, pool);
+}
+
+#endif //STB_IMAGE_WRAPPER_INCLUDE
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+#ifdef STB_IMAGE_WRAPPER_IMPLEMENTATION
+
+// stb memory goes to ImageAllocator::current() (unless user routed it elsewhere)
+static void* stb_image_wrapper_malloc(size_t size);
+static void* stb_image_wrapper_realloc(void *ptr, size_t size);
+static void stb_image_wrapper_free(void *ptr);
+
+#if !defined(STBI_MALLOC) && !defined(STBI_FREE) && !defined(STBI_REALLOC) && !defined(STBI_REALLOC_SIZED)
+#define STBI_MALLOC(size)           stb_image_wrapper_malloc(size)
+#define STBI_REALLOC(ptr, size)     stb_image_wrapper_realloc(ptr, size)
+#define STBI_FREE(ptr)              stb_image_wrapper_free(ptr)
+#endif
+#if !defined(STBIW_MALLOC) && !defined(STBIW_FREE) && !defined(STBIW_REALLOC) && !defined(STBIW_REALLOC_SIZED)
+#define STBIW_MALLOC(size)          stb_image_wrapper_malloc(size)
+#define STBIW_REALLOC(ptr, size)    stb_image_wrapper_realloc(ptr, size)
+#define STBIW_FREE(ptr)             stb_image_wrapper_free(ptr)
+#endif
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+extern "C" {
+    #include "stb/stb_image.h"
+    #include "stb/stb_image_resize2.h"
+    #include "stb/stb_image_write.h"
+}
+
+static const size_t DEFAULT_IMAGE_ALIGNMENT = 16;
+
+// stb frees memory without size, so size & allocator are stored in front of every stb allocation
+struct StbAllocationHeader {
+    ImageAllocator *allocator;
+    size_t size;
+};
+static_assert(sizeof(StbAllocationHeader) <= DEFAULT_IMAGE_ALIGNMENT);
+
+static void* stb_image_wrapper_malloc(size_t size) {
+    ImageAllocator &allocator = ImageAllocator::current();
+    try {
+        uint8_t *block = (uint8_t*)allocator.allocate(size + DEFAULT_IMAGE_ALIGNMENT, DEFAULT_IMAGE_ALIGNMENT);
+        *(StbAllocationHeader*)block = {&allocator, size};
+        return block + DEFAULT_IMAGE_ALIGNMENT;
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+static void* stb_image_wrapper_realloc(void *ptr, size_t size) {
+    if (!ptr) return stb_image_wrapper_malloc(size);
+
+    uint8_t *block = (uint8_t*)ptr - DEFAULT_IMAGE_ALIGNMENT;
+    StbAllocationHeader header = *(StbAllocationHeader*)block;
+    try {
+        block = (uint8_t*)header.allocator->reallocate(block, header.size + DEFAULT_IMAGE_ALIGNMENT, size + DEFAULT_IMAGE_ALIGNMENT, DEFAULT_IMAGE_ALIGNMENT);
+        ((StbAllocationHeader*)block)->size = size;
+        return block + DEFAULT_IMAGE_ALIGNMENT;
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+static void stb_image_wrapper_free(void *ptr) {
+    if (!ptr) return;
+
+    uint8_t *block = (uint8_t*)ptr - DEFAULT_IMAGE_ALIGNMENT;
+    StbAllocationHeader header = *(StbAllocationHeader*)block;
+    header.allocator->deallocate(block, header.size + DEFAULT_IMAGE_ALIGNMENT, DEFAULT_IMAGE_ALIGNMENT);
+}
+
+void Image::init_loaded(uint8_t *data, int desired_number_of_channels, const std::string &source) {
+    this->data = data;
+    if (!this->data) {
+        throw std::runtime_error("Cannot load image " + source);
+    }
+    if (desired_number_of_channels) this->channels = desired_number_of_channels;
+    this->stride = this->width * this->pixel_size();
+}
+
+Image::Image(const char* filepath, int desired_number_of_channels, SampleType sample): owner(STB), sample(sample) {
+    uint8_t *data;
+    switch (sample) {
+    case U16: data = (uint8_t*)stbi_load_16(filepath, &this->width, &this->height, &this->channels, desired_number_of_channels); break;
+    case F32: data = (uint8_t*)stbi_loadf(filepath, &this->width, &this->height, &this->channels, desired_number_of_channels); break;
+    default:  data = stbi_load(filepath, &this->width, &this->height, &this->channels, desired_number_of_channels); break;
+    }
+    this->init_loaded(data, desired_number_of_channels, filepath);
+}
+
+Image::Image(const std::string &filepath, int desired_number_of_channels, SampleType sample): 
+    Image(filepath.c_str(), desired_number_of_channels, sample) {}
+
+Image::Image(std::span<const uint8_t> encoded, int desired_number_of_channels, SampleType sample): owner(STB), sample(sample) {
+    uint8_t *data;
+    switch (sample) {
+    case U16: data = (uint8_t*)stbi_load_16_from_memory(encoded.data(), encoded.size(), &this->width, &this->height, &this->channels, desired_number_of_channels); break;
+    case F32: data = (uint8_t*)stbi_loadf_from_memory(encoded.data(), encoded.size(), &this->width, &this->height, &this->channels, desired_number_of_channels); break;
+    default:  data = stbi_load_from_memory(encoded.data(), encoded.size(), &this->width, &this->height, &this->channels, desired_number_of_channels); break;
+    }
+    this->init_loaded(data, desired_number_of_channels, "from memory");
+}
+
+static int image_reader_read(void *user, char *data, int size) {
+    return ((ImageReader*)user)->read(data, size);
+}
+static void image_reader_skip(void *user, int n) {
+    ((ImageReader*)user)->skip(n);
+}
+static int image_reader_eof(void *user) {
+    return ((ImageReader*)user)->eof();
+}
+static const stbi_io_callbacks image_reader_callbacks = {
+    image_reader_read,
+    image_reader_skip,
+    image_reader_eof,
+};
+
+Image::Image(ImageReader &reader, int desired_number_of_channels, SampleType sample): owner(STB), sample(sample) {
+    uint8_t *data;
+    switch (sample) {
+    case U16: data = (uint8_t*)stbi_load_16_from_callbacks(&image_reader_callbacks, &reader, &this->width, &this->height, &this->channels, desired_number_of_channels); break;
+    case F32: data = (uint8_t*)stbi_loadf_from_callbacks(&image_reader_callbacks, &reader, &this->width, &this->height, &this->channels, desired_number_of_channels); break;
+    default:  data = stbi_load_from_callbacks(&image_reader_callbacks, &reader, &this->width, &this->height, &this->channels, desired_number_of_channels); break;
+    }
+    this->init_loaded(data, desired_number_of_channels, "from reader");
+}
+
+Image::Image(int width, int height, int channels, int alignment): Image(width, height, channels, U8, alignment) {}
+
+Image::Image(int width, int height, int channels, SampleType sample, int alignment): owner(LOCAL), sample(sample) {
+    assert(width>0);
+    assert(height>0);
+    assert(channels>0);
+    assert(alignment>=0 && (alignment & (alignment-1)) == 0);
+
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+
+    this->allocate(alignment);
+}
+
+Image::Image(uint8_t *data, int width, int height, int channels, int stride, SampleType sample): owner(NONE), sample(sample) {
+    assert(data);
+    assert(width>0);
+    assert(height>0);
+    assert(channels>0);
+    assert(stride == 0 || stride >= width*channels*sample);
+
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+    this->stride = stride ? stride : width*this->pixel_size();
+
+    this->data = data;
+}
+
+Image::Image(const ConstImageView &view): owner(LOCAL) {
+    assert(view.data);
+
+    this->width = view.width;
+    this->height = view.height;
+    this->channels = view.channels;
+    this->sample = view.sample;
+
+    this->allocate(0);
+    this->copy_rows(view);
+}
+
+Image::~Image() {
+    this->release();
+}
+
+void Image::allocate(int alignment) {
+    this->alignment = alignment;
+    if (alignment) {
+        this->stride = (width*this->pixel_size() + alignment - 1) & ~(alignment - 1);
+    } else {
+        this->stride = width*this->pixel_size();
+    }
+    this->allocator = &ImageAllocator::current();
+    this->data = (uint8_t*)this->allocator->allocate((size_t)stride*height, alignment ? alignment : DEFAULT_IMAGE_ALIGNMENT);
+}
+
+void Image::release() {
+    if (this->data) {
+        switch (this->owner) {
+        case NONE:
+            break;
+        case LOCAL:
+            this->allocator->deallocate(this->data, (size_t)this->stride*this->height, this->alignment ? this->alignment : DEFAULT_IMAGE_ALIGNMENT);
+            break;
+        case STB:
+            stbi_image_free(this->data);
+            break;
+
+        default:
+            std::cerr << "Not handled owner type " << this->owner << std::endl;
+            break;
+        }
+
+        this->data = NULL;
+        this->owner = NONE;
+    }
+}
+
+void Image::copy_rows(const ConstImageView &src) {
+    int row_size = width*this->pixel_size();
+    if (src.stride == row_size && this->stride == row_size) {
+        memcpy(this->data, src.data, (size_t)row_size*height);
+        return;
+    }
+    for (int y=0; y<height; y++) {
+        memcpy(this->data + (size_t)y*this->stride, src.data + (size_t)y*src.stride, row_size);
+    }
+}
+
+Image::Image(const Image &other) {
+    if (this != &other) {
+        this->width = other.width;
+        this->height = other.height;
+        this->channels = other.channels;
+        this->sample = other.sample;
+
+        this->owner = LOCAL;
+
+        // copy keeps row alignment of local images, external & stb memory is copied packed
+        this->allocate(other.owner == LOCAL ? other.alignment : 0);
+        this->copy_rows(other);
+    }
+}
+
+Image::Image(Image &&other) {
+    if (this != &other) {
+        this->width = other.width;
+        this->height = other.height;
+        this->channels = other.channels;
+        this->sample = other.sample;
+        this->stride = other.stride;
+        this->alignment = other.alignment;
+        this->allocator = other.allocator;
+        
+        this->owner = other.owner;
+        other.owner = NONE;
+
+        this->data = other.data;
+        other.data = NULL;
+    }
+}
+
+Image& Image::operator=(const Image &other) {
+    if (this != &other) {
+        this->release();
+
+        this->width = other.width;
+        this->height = other.height;
+        this->channels = other.channels;
+        this->sample = other.sample;
+
+        this->owner = LOCAL;
+
+        this->allocate(other.owner == LOCAL ? other.alignment : 0);
+        this->copy_rows(other);
+    }
+    return *this;
+}
+
+Image& Image::operator=(Image &&other) {
+    if (this != &other) {
+        this->release();
+
+        this->width = other.width;
+        this->height = other.height;
+        this->channels = other.channels;
+        this->sample = other.sample;
+        this->stride = other.stride;
+        this->alignment = other.alignment;
+        this->allocator = other.allocator;
+
+        this->owner = other.owner;
+        other.owner = NONE;
+
+        this->data = other.data;
+        other.data = NULL;
+    }
+    return *this;
+}
+
+int Image::save_jpg(const char* filepath, int quality) {
+    return ConstImageView(*this).save_jpg(filepath, quality);
+}
+int Image::save_jpg(const std::string &filepath, int quality) {
+    return ConstImageView(*this).save_jpg(filepath, quality);
+}
+
+int Image::save_png(const char* filepath) {
+    return ConstImageView(*this).save_png(filepath);
+}
+int Image::save_png(const std::string &filepath) {
+    return ConstImageView(*this).save_png(filepath);
+}
+
+int Image::save_hdr(const char* filepath) {
+    return ConstImageView(*this).save_hdr(filepath);
+}
+int Image::save_hdr(const std::string &filepath) {
+    return ConstImageView(*this).save_hdr(filepath);
+}
+
+uint8_t* Image::at(int x, int y) {
+    if (x < 0 || x >= this->width) throw std::range_error("x is out of range: " + std::to_string(x));
+    if (y < 0 || y >= this->height) throw std::range_error("y is out of range: " + std::to_string(y));
+    
+    return this->data + (size_t)y*this->stride + x*this->pixel_size();
+}
+
+const uint8_t* Image::at(int x, int y) const {
+    if (x < 0 || x >= this->width) throw std::range_error("x is out of range: " + std::to_string(x));
+    if (y < 0 || y >= this->height) throw std::range_error("y is out of range: " + std::to_string(y));
+    
+    return this->data + (size_t)y*this->stride + x*this->pixel_size();
+}
+
+Image Image::resized(int width, int height, stbir_filter filter, stbir_edge edge) const {
+    Resizer resizer(width, height, filter, edge);
+    return resizer.resize(*this);
+}
+
+Image Image::converted(SampleType sample) const {
+    Image result(this->width, this->height, this->channels, sample);
+    convert_samples(*this, result);
+    return result;
+}
+
+
+
+static void finish_probe(ImageInfo &info, bool is_16_bit, bool is_hdr) {
+    info.hdr = is_hdr;
+    if (is_hdr) info.bits_per_channel = 32;
+    else if (is_16_bit) info.bits_per_channel = 16;
+    else info.bits_per_channel = 8;
+}
+
+ImageInfo Image::probe(const char* filepath) {
+    ImageInfo info;
+    FILE *file = fopen(filepath, "rb");
+    if (!file) return info;
+
+    // *_from_file functions restore file position, so the header is read from one open file
+    info.valid = stbi_info_from_file(file, &info.width, &info.height, &info.channels);
+    if (info.valid) {
+        finish_probe(info, stbi_is_16_bit_from_file(file), stbi_is_hdr_from_file(file));
+    }
+    fclose(file);
+    return info;
+}
+
+ImageInfo Image::probe(const std::string &filepath) {
+    return Image::probe(filepath.c_str());
+}
+
+ImageInfo Image::probe(std::span<const uint8_t> encoded) {
+    ImageInfo info;
+    info.valid = stbi_info_from_memory(encoded.data(), encoded.size(), &info.width, &info.height, &info.channels);
+    if (info.valid) {
+        finish_probe(info, 
+            stbi_is_16_bit_from_memory(encoded.data(), encoded.size()), 
+            stbi_is_hdr_from_memory(encoded.data(), encoded.size())
+        );
+    }
+    return info;
+}
+
+ImageInfo Image::probe(ImageReader &reader, int max_header_bytes) {
+    // stream cannot be rewound, so growing prefix of it is probed from memory
+    std::vector<uint8_t> header;
+    int size = 4096;
+    while (true) {
+        if (size > max_header_bytes) size = max_header_bytes;
+        int old_size = header.size();
+        header.resize(size);
+        int got = reader.read((char*)header.data() + old_size, size - old_size);
+        header.resize(old_size + (got > 0 ? got : 0));
+
+        ImageInfo info = Image::probe(std::span<const uint8_t>(header));
+        if (info.valid || reader.eof() || got <= 0 || size >= max_header_bytes) return info;
+        size *= 2;
+    }
+}
+
+std::vector<ImageInfo> Image::probe(const std::vector<std::string> &filepaths) {
+    std::vector<ImageInfo> infos(filepaths.size());
+    ThreadPool::shared().parallel_for(filepaths.size(), [&](int i) {
+        infos[i] = Image::probe(filepaths[i]);
+    });
+    return infos;
+}
+
+std::vector<std::pair<std::string, ImageInfo>> Image::probe_directory(const std::string &dirpath) {
+    std::vector<std::string> filepaths;
+    for (const auto &entry: std::filesystem::directory_iterator(dirpath)) {
+        if (entry.is_regular_file()) filepaths.push_back(entry.path().string());
+    }
+
+    std::vector<ImageInfo> infos = Image::probe(filepaths);
+    std::vector<std::pair<std::string, ImageInfo>> result;
+    result.reserve(filepaths.size());
+    for (size_t i=0; i<filepaths.size(); i++) {
+        result.emplace_back(std::move(filepaths[i]), infos[i]);
+    }
+    return result;
+}
+
+StreamReader::StreamReader(std::istream &stream): stream(stream) {}
+
+int StreamReader::read(char *buffer, int size) {
+    this->stream.read(buffer, size);
+    return this->stream.gcount();
+}
+
+void StreamReader::skip(int n) {
+    if (n > 0) {
+        this->stream.ignore(n);
+    } else {
+        this->stream.clear();
+        this->stream.seekg(n, std::ios::cur);
+    }
+}
+
+bool StreamReader::eof() {
+    return this->stream.peek() == std::istream::traits_type::eof();
+}
+
+
+
+ImageView::ImageView(uint8_t *data, int width, int height, int channels, int stride, Image::SampleType sample): 
+    data(data), width(width), height(height), channels(channels), sample(sample), stride(stride ? stride : width*channels*sample) {}
+
+ImageView::ImageView(Image &img): 
+    data(img.data), width(img.width), height(img.height), channels(img.channels), sample(img.sample), stride(img.stride) {}
+
+ImageView::ImageView(Image &img, int x, int y, int width, int height): ImageView(ImageView(img).sub(x, y, width, height)) {}
+
+ImageView ImageView::sub(int x, int y, int width, int height) const {
+    if (x < 0 || width < 0 || x + width > this->width) throw std::range_error("sub-view x range is out of view: " + std::to_string(x) + "+" + std::to_string(width));
+    if (y < 0 || height < 0 || y + height > this->height) throw std::range_error("sub-view y range is out of view: " + std::to_string(y) + "+" + std::to_string(height));
+
+    return ImageView(this->data + (size_t)y*this->stride + x*this->pixel_size(), width, height, this->channels, this->stride, this->sample);
+}
+
+uint8_t* ImageView::at(int x, int y) const {
+    if (x < 0 || x >= this->width) throw std::range_error("x is out of range: " + std::to_string(x));
+    if (y < 0 || y >= this->height) throw std::range_error("y is out of range: " + std::to_string(y));
+
+    return this->data + (size_t)y*this->stride + x*this->pixel_size();
+}
+
+int ImageView::save_jpg(const char* filepath, int quality) const {
+    return ConstImageView(*this).save_jpg(filepath, quality);
+}
+int ImageView::save_jpg(const std::string &filepath, int quality) const {
+    return ConstImageView(*this).save_jpg(filepath, quality);
+}
+
+int ImageView::save_png(const char* filepath) const {
+    return ConstImageView(*this).save_png(filepath);
+}
+int ImageView::save_png(const std::string &filepath) const {
+    return ConstImageView(*this).save_png(filepath);
+}
+
+int ImageView::save_hdr(const char* filepath) const {
+    return ConstImageView(*this).save_hdr(filepath);
+}
+int ImageView::save_hdr(const std::string &filepath) const {
+    return ConstImageView(*this).save_hdr(filepath);
+}
+
+
+
+ConstImageView::ConstImageView(const uint8_t *data, int width, int height, int channels, int stride, Image::SampleType sample): 
+    data(data), width(width), height(height), channels(channels), sample(sample), stride(stride ? stride : width*channels*sample) {}
+
+ConstImageView::ConstImageView(const Image &img): 
+    data(img.data), width(img.width), height(img.height), channels(img.channels), sample(img.sample), stride(img.stride) {}
+
+ConstImageView::ConstImageView(const Image &img, int x, int y, int width, int height): ConstImageView(ConstImageView(img).sub(x, y, width, height)) {}
+
+ConstImageView::ConstImageView(const ImageView &view): 
+    data(view.data), width(view.width), height(view.height), channels(view.channels), sample(view.sample), stride(view.stride) {}
+
+ConstImageView ConstImageView::sub(int x, int y, int width, int height) const {
+    if (x < 0 || width < 0 || x + width > this->width) throw std::range_error("sub-view x range is out of view: " + std::to_string(x) + "+" + std::to_string(width));
+    if (y < 0 || height < 0 || y + height > this->height) throw std::range_error("sub-view y range is out of view: " + std::to_string(y) + "+" + std::to_string(height));
+
+    return ConstImageView(this->data + (size_t)y*this->stride + x*this->pixel_size(), width, height, this->channels, this->stride, this->sample);
+}
+
+const uint8_t* ConstImageView::at(int x, int y) const {
+    if (x < 0 || x >= this->width) throw std::range_error("x is out of range: " + std::to_string(x));
+    if (y < 0 || y >= this->height) throw std::range_error("y is out of range: " + std::to_string(y));
+
+    return this->data + (size_t)y*this->stride + x*this->pixel_size();
+}
+
+// most of stbi_write_* have no stride parameter and take one sample type,
+// so rows with padding or of other sample type are packed/converted into tmp first
+static const uint8_t* packed_rows(const ConstImageView &img, Image::SampleType sample, std::vector<uint8_t> &tmp) {
+    int row_size = img.width*img.channels*sample;
+    if (img.stride == row_size && img.sample == sample) {
+        return img.data;
+    }
+
+    tmp.resize((size_t)row_size*img.height);
+    convert_samples(img, ImageView(tmp.data(), img.width, img.height, img.channels, row_size, sample));
+    return tmp.data();
+}
+
+int ConstImageView::save_jpg(const char* filepath, int quality) const {
+    std::vector<uint8_t> tmp;
+    return stbi_write_jpg(filepath, this->width, this->height, this->channels, packed_rows(*this, Image::U8, tmp), quality);
+}
+int ConstImageView::save_jpg(const std::string &filepath, int quality) const {
+    return this->save_jpg(filepath.c_str(), quality);
+}
+
+int ConstImageView::save_png(const char* filepath) const {
+    if (this->sample != Image::U8) {
+        std::vector<uint8_t> tmp;
+        return stbi_write_png(filepath, this->width, this->height, this->channels, packed_rows(*this, Image::U8, tmp), 0);
+    }
+    return stbi_write_png(filepath, this->width, this->height, this->channels, this->data, this->stride);
+}
+int ConstImageView::save_png(const std::string &filepath) const {
+    return this->save_png(filepath.c_str());
+}
+
+int ConstImageView::save_hdr(const char* filepath) const {
+    std::vector<uint8_t> tmp;
+    return stbi_write_hdr(filepath, this->width, this->height, this->channels, (const float*)packed_rows(*this, Image::F32, tmp));
+}
+int ConstImageView::save_hdr(const std::string &filepath) const {
+    return this->save_hdr(filepath.c_str());
+}
+
+
+
+VectorWriter::VectorWriter(std::vector<uint8_t> &buffer): buffer(buffer) {}
+
+void VectorWriter::write(const void *data, int size) {
+    this->buffer.insert(this->buffer.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+StreamWriter::StreamWriter(std::ostream &stream): stream(stream) {}
+
+void StreamWriter::write(const void *data, int size) {
+    this->stream.write((const char*)data, size);
+}
+
+static void image_writer_write(void *context, void *data, int size) {
+    ((ImageWriter*)context)->write(data, size);
+}
+
+int encode_png(ConstImageView img, ImageWriter &writer) {
+    if (img.sample != Image::U8) {
+        std::vector<uint8_t> tmp;
+        return stbi_write_png_to_func(image_writer_write, &writer, img.width, img.height, img.channels, packed_rows(img, Image::U8, tmp), 0);
+    }
+    return stbi_write_png_to_func(image_writer_write, &writer, img.width, img.height, img.channels, img.data, img.stride);
+}
+int encode_png(ConstImageView img, std::vector<uint8_t> &out) {
+    out.clear();
+    VectorWriter writer(out);
+    return encode_png(img, writer);
+}
+
+int encode_jpg(ConstImageView img, ImageWriter &writer, int quality) {
+    std::vector<uint8_t> tmp;
+    return stbi_write_jpg_to_func(image_writer_write, &writer, img.width, img.height, img.channels, packed_rows(img, Image::U8, tmp), quality);
+}
+int encode_jpg(ConstImageView img, std::vector<uint8_t> &out, int quality) {
+    out.clear();
+    VectorWriter writer(out);
+    return encode_jpg(img, writer, quality);
+}
+
+int encode_bmp(ConstImageView img, ImageWriter &writer) {
+    std::vector<uint8_t> tmp;
+    return stbi_write_bmp_to_func(image_writer_write, &writer, img.width, img.height, img.channels, packed_rows(img, Image::U8, tmp));
+}
+int encode_bmp(ConstImageView img, std::vector<uint8_t> &out) {
+    out.clear();
+    VectorWriter writer(out);
+    return encode_bmp(img, writer);
+}
+
+int encode_tga(ConstImageView img, ImageWriter &writer) {
+    std::vector<uint8_t> tmp;
+    return stbi_write_tga_to_func(image_writer_write, &writer, img.width, img.height, img.channels, packed_rows(img, Image::U8, tmp));
+}
+int encode_tga(ConstImageView img, std::vector<uint8_t> &out) {
+    out.clear();
+    VectorWriter writer(out);
+    return encode_tga(img, writer);
+}
+
+int encode_hdr(ConstImageView img, ImageWriter &writer) {
+    std::vector<uint8_t> tmp;
+    return stbi_write_hdr_to_func(image_writer_write, &writer, img.width, img.height, img.channels, (const float*)packed_rows(img, Image::F32, tmp));
+}
+int encode_hdr(ConstImageView img, std::vector<uint8_t> &out) {
+    out.clear();
+    VectorWriter writer(out);
+    return encode_hdr(img, writer);
+}
+
+
+
+static inline void convert_sample(uint8_t v, uint8_t &out) { out = v; }
+static inline void convert_sample(uint8_t v, uint16_t &out) { out = v*257; }
+static inline void convert_sample(uint8_t v, float &out) { out = v * (1.0f/255); }
+static inline void convert_sample(uint16_t v, uint8_t &out) { out = (v + 128) / 257; }
+static inline void convert_sample(uint16_t v, uint16_t &out) { out = v; }
+static inline void convert_sample(uint16_t v, float &out) { out = v * (1.0f/65535); }
+// written so that NaN ends up as 0
+static inline void convert_sample(float v, uint8_t &out) { out = !(v > 0) ? 0 : v >= 1 ? 255 : (uint8_t)(v*255 + 0.5f); }
+static inline void convert_sample(float v, uint16_t &out) { out = !(v > 0) ? 0 : v >= 1 ? 65535 : (uint16_t)(v*65535 + 0.5f); }
+static inline void convert_sample(float v, float &out) { out = v; }
+
+template<class From, class To>
+static void convert_sample_rows(ConstImageView src, ImageView dst) {
+    int count = src.width*src.channels;
+    for (int y=0; y<src.height; y++) {
+        const From *in = (const From*)(src.data + (size_t)y*src.stride);
+        To *out = (To*)(dst.data + (size_t)y*dst.stride);
+        for (int i=0; i<count; i++) {
+            convert_sample(in[i], out[i]);
+        }
+    }
+}
+
+template<class From>
+static void convert_sample_rows_from(ConstImageView src, ImageView dst) {
+    switch (dst.sample) {
+    case Image::U8:  convert_sample_rows<From, uint8_t>(src, dst); break;
+    case Image::U16: convert_sample_rows<From, uint16_t>(src, dst); break;
+    case Image::F32: convert_sample_rows<From, float>(src, dst); break;
+    }
+}
+
+void convert_samples(ConstImageView src, ImageView dst) {
+    if (src.width != dst.width || src.height != dst.height || src.channels != dst.channels) {
+        throw std::invalid_argument("Sample conversion destination does not match source");
+    }
+    switch (src.sample) {
+    case Image::U8:  convert_sample_rows_from<uint8_t>(src, dst); break;
+    case Image::U16: convert_sample_rows_from<uint16_t>(src, dst); break;
+    case Image::F32: convert_sample_rows_from<float>(src, dst); break;
+    }
+}
+
+#if !defined(STB_IMAGE_WRAPPER_NO_SIMD)
+    #if defined(__AVX2__)
+        #define STB_IMAGE_WRAPPER_AVX2
+        #include <immintrin.h>
+    #elif defined(__SSE2__) || defined(_M_X64)
+        #define STB_IMAGE_WRAPPER_SSE2
+        #include <emmintrin.h>
+    #endif
+#endif
+
+#if defined(STB_IMAGE_WRAPPER_AVX2)
+
+static void load_u8_row(const uint8_t *in, float *out, int n) {
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(v));
+    }
+    for (; i<n; i++) out[i] = in[i];
+}
+
+static void store_u8_row(const float *in, uint8_t *out, int n) {
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+    for (; i+32<=n; i+=32) {
+        __m256i v[4];
+        // cvtps rounds to nearest, packs saturate to [0, 255]
+        for (int j=0; j<4; j++) v[j] = _mm256_cvtps_epi32(_mm256_loadu_ps(in + i + 8*j));
+        __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_permutevar8x32_epi32(bytes, order));
+    }
+    for (; i<n; i++) out[i] = (uint8_t)std::clamp((int)lrintf(in[i]), 0, 255);
+}
+
+#elif defined(STB_IMAGE_WRAPPER_SSE2)
+
+static void load_u8_row(const uint8_t *in, float *out, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i+16<=n; i+=16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps(out + i,      _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(out + i + 4,  _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(out + i + 8,  _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(out + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+    for (; i<n; i++) out[i] = in[i];
+}
+
+static void store_u8_row(const float *in, uint8_t *out, int n) {
+    int i = 0;
+    for (; i+16<=n; i+=16) {
+        __m128i v[4];
+        for (int j=0; j<4; j++) v[j] = _mm_cvtps_epi32(_mm_loadu_ps(in + i + 4*j));
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+        _mm_storeu_si128((__m128i*)(out + i), bytes);
+    }
+    for (; i<n; i++) out[i] = (uint8_t)std::clamp((int)lrintf(in[i]), 0, 255);
+}
+
+#else
+
+static void load_u8_row(const uint8_t *in, float *out, int n) {
+    for (int i=0; i<n; i++) out[i] = in[i];
+}
+
+static void store_u8_row(const float *in, uint8_t *out, int n) {
+    for (int i=0; i<n; i++) out[i] = (uint8_t)std::clamp((int)lrintf(in[i]), 0, 255);
+}
+
+#endif
+
+void load_sample_row(const uint8_t *in, Image::SampleType sample, float *out, int n) {
+    switch (sample) {
+    case Image::U8: load_u8_row(in, out, n); break;
+    case Image::U16: for (int i=0; i<n; i++) out[i] = ((const uint16_t*)in)[i]; break;
+    case Image::F32: memcpy(out, in, n*sizeof(float)); break;
+    }
+}
+
+void store_sample_row(const float *in, uint8_t *out, Image::SampleType sample, int n) {
+    switch (sample) {
+    case Image::U8: store_u8_row(in, out, n); break;
+    case Image::U16: for (int i=0; i<n; i++) ((uint16_t*)out)[i] = (uint16_t)std::clamp((int)lrintf(in[i]), 0, 65535); break;
+    case Image::F32: memcpy(out, in, n*sizeof(float)); break;
+    }
+}
+
+ConstImageView unaliased_source(ConstImageView src, ConstImageView dst, std::optional<Image> &copy) {
+    const uint8_t *src_end = src.data + (size_t)(src.height - 1)*src.stride + (size_t)src.width*src.pixel_size();
+    const uint8_t *dst_end = dst.data + (size_t)(dst.height - 1)*dst.stride + (size_t)dst.width*dst.pixel_size();
+    if (src.data >= dst_end || dst.data >= src_end) return src;
+
+    ImageView view(copy.emplace(src.width, src.height, src.channels, src.sample));
+    for (int y=0; y<src.height; y++) {
+        memcpy(view.data + (size_t)y*view.stride, src.data + (size_t)y*src.stride, (size_t)src.width*src.pixel_size());
+    }
+    return view;
+}
+
+
+
+static stbir_pixel_layout stbir_layout_from_channels(int channels) {
+    switch (channels) {
+    case 1: return STBIR_1CHANNEL;
+    case 2: return STBIR_RA;
+    case 3: return STBIR_RGB;
+    case 4: return STBIR_RGBA;
+    default:
+        throw std::invalid_argument("Cannot resize image with " + std::to_string(channels) + " channels");
+    }
+}
+
+static stbir_datatype stbir_type_from_sample(Image::SampleType sample) {
+    switch (sample) {
+    case Image::U16: return STBIR_TYPE_UINT16;
+    case Image::F32: return STBIR_TYPE_FLOAT;
+    default:         return STBIR_TYPE_UINT8;
+    }
+}
+
+Resizer::Resizer(int width, int height, stbir_filter filter, stbir_edge edge): 
+    width(width), height(height), filter(filter), edge(edge) 
+{
+    assert(width>0);
+    assert(height>0);
+}
+
+Resizer::~Resizer() {
+    if (this->built) {
+        stbir_free_samplers(&this->resize_info);
+        this->built = false;
+    }
+}
+
+void Resizer::prepare(ConstImageView src, ImageView dst) {
+    if (dst.width != this->width || dst.height != this->height || dst.channels != src.channels || dst.sample != src.sample) {
+        throw std::invalid_argument("Resize destination does not match resizer output");
+    }
+
+    // changing buffers is free, anything else requires new samplers
+    if (this->built 
+        && src.width == this->input_width && src.height == this->input_height && src.channels == this->input_channels && src.sample == this->input_sample
+        && this->filter == this->built_filter && this->edge == this->built_edge && this->pool == this->built_pool
+        && this->srgb == this->built_srgb
+    ) {
+        stbir_set_buffer_ptrs(&this->resize_info, src.data, src.stride, dst.data, dst.stride);
+        return;
+    }
+
+    if (this->built) {
+        stbir_free_samplers(&this->resize_info);
+        this->built = false;
+    }
+
+    stbir_resize_init(&this->resize_info, 
+        src.data, src.width, src.height, src.stride,
+        dst.data, this->width, this->height, dst.stride,
+        stbir_layout_from_channels(src.channels), 
+        this->srgb && src.sample == Image::U8 ? STBIR_TYPE_UINT8_SRGB : stbir_type_from_sample(src.sample)
+    );
+    stbir_set_filters(&this->resize_info, this->filter, this->filter);
+    stbir_set_edgemodes(&this->resize_info, this->edge, this->edge);
+
+    if (this->pool && this->pool->size() > 1) {
+        this->splits = stbir_build_samplers_with_splits(&this->resize_info, this->pool->size());
+    } else {
+        this->splits = stbir_build_samplers(&this->resize_info) ? 1 : 0;
+    }
+    if (!this->splits) {
+        throw std::runtime_error("Cannot build resize samplers");
+    }
+    this->built = true;
+    this->input_width = src.width;
+    this->input_height = src.height;
+    this->input_channels = src.channels;
+    this->input_sample = src.sample;
+    this->built_filter = this->filter;
+    this->built_edge = this->edge;
+    this->built_pool = this->pool;
+    this->built_srgb = this->srgb;
+}
+
+Image Resizer::resize(ConstImageView src) {
+    Image dst(this->width, this->height, src.channels, src.sample);
+    this->resize(src, dst);
+    return dst;
+}
+
+void Resizer::resize(ConstImageView src, ImageView dst) {
+    this->prepare(src, dst);
+    if (this->splits > 1) {
+        std::atomic<bool> ok{true};
+        this->pool->parallel_for(this->splits, [&](int split) {
+            if (!stbir_resize_extended_split(&this->resize_info, split, 1)) ok = false;
+        });
+        if (!ok) throw std::runtime_error("Cannot resize image");
+    }
+    else if (!stbir_resize_extended(&this->resize_info)) {
+        throw std::runtime_error("Cannot resize image");
+    }
+}
+
 
-    PixelRGBA& operator+=(const PixelRGBA& other);
-    PixelRGBA& operator-=(const PixelRGBA& other);
-};
-PixelRGBA operator*(float k, PixelRGBA& pix);
-std::ostream& operator<<(std::ostream& os, const PixelRGBA& p);
 
-struct ColorRGBA;
-struct ColorYCbCrA; 
+static ImageAllocator *default_image_allocator = nullptr;
+static thread_local ImageAllocator *scoped_image_allocator = nullptr;
 
-struct ColorRGBA {
-    double r, g, b;
-    double a = 1;
+void* ImageAllocator::reallocate(void *ptr, size_t old_size, size_t new_size, size_t alignment) {
+    void *result = this->allocate(new_size, alignment);
+    memcpy(result, ptr, std::min(old_size, new_size));
+    this->deallocate(ptr, old_size, alignment);
+    return result;
+}
 
-    ColorRGBA();
-    ColorRGBA(double r, double g, double b);
-    ColorRGBA(double r, double g, double b, double a);
-    ColorRGBA(const PixelGray& p);
-    ColorRGBA(const PixelRGB& rgb);
-    ColorRGBA(const PixelRGBA& rgba);
-    ColorRGBA(const ColorYCbCrA& ycbcra);
+ImageAllocator& ImageAllocator::current() {
+    if (scoped_image_allocator) return *scoped_image_allocator;
+    if (default_image_allocator) return *default_image_allocator;
+    return heap();
+}
 
-    ColorRGBA operator*(double k);
-    ColorRGBA operator/(double k);
+ImageAllocator& ImageAllocator::heap() {
+    static HeapAllocator allocator;
+    return allocator;
+}
 
-    ColorRGBA operator+(const ColorRGBA& other);
-    ColorRGBA operator-(const ColorRGBA& other);
+void ImageAllocator::set_default(ImageAllocator *allocator) {
+    default_image_allocator = allocator;
+}
 
-    ColorRGBA& operator*=(double k);
-    ColorRGBA& operator+=(const ColorRGBA& other);
-    ColorRGBA& operator-=(const ColorRGBA& other);
+void* HeapAllocator::allocate(size_t size, size_t alignment) {
+    return ::operator new(size, std::align_val_t(alignment));
+}
 
-    explicit operator PixelGray() const;
-    explicit operator PixelRGB() const;
-    explicit operator PixelRGBA() const;
+void HeapAllocator::deallocate(void *ptr, size_t, size_t alignment) {
+    ::operator delete(ptr, std::align_val_t(alignment));
+}
 
-    explicit operator ColorYCbCrA() const;
-};
-ColorRGBA operator*(double k, const ColorRGBA& pix);
-std::ostream& operator<<(std::ostream& os, const ColorRGBA& p);
+ArenaAllocator::ArenaAllocator(size_t block_size): block_size(block_size) {
+    assert(block_size > 0);
+}
 
-struct ColorYCbCrA {
-    // Kr & Kb MAY! be edited, and it will affect forward and backward conversions
-    static double Kr; 
-    static double Kb;
+ArenaAllocator::~ArenaAllocator() {
+    this->release();
+}
 
-    double y, cb, cr;
-    double a = 1;
+void* ArenaAllocator::allocate(size_t size, size_t alignment) {
+    std::lock_guard<std::mutex> guard(this->lock);
 
-    ColorYCbCrA();
-    ColorYCbCrA(double y, double cb, double cr);
-    ColorYCbCrA(double y, double cb, double cr, double a);
-    ColorYCbCrA(const ColorRGBA& clr);
+    for (; this->current_block < this->blocks.size(); this->current_block++) {
+        Block &block = this->blocks[this->current_block];
+        uintptr_t start = ((uintptr_t)block.data + block.used + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        size_t end = start - (uintptr_t)block.data + size;
+        if (end <= block.size) {
+            block.used = end;
+            this->last = (uint8_t*)start;
+            return this->last;
+        }
+    }
 
-    ColorYCbCrA operator*(double k);
-    ColorYCbCrA operator/(double k);
+    // blocks are aligned to 64, bigger alignments are handled by padding
+    size_t padding = alignment > 64 ? alignment : 0;
+    Block block;
+    block.size = std::max(this->block_size, size + padding);
+    block.data = (uint8_t*) ::operator new(block.size, std::align_val_t(64));
+    uintptr_t start = ((uintptr_t)block.data + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    block.used = start - (uintptr_t)block.data + size;
+    this->blocks.push_back(block);
+    this->current_block = this->blocks.size() - 1;
+    this->last = (uint8_t*)start;
+    return this->last;
+}
+
+void ArenaAllocator::deallocate(void *ptr, size_t size, size_t) {
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    // only the most recent allocation can be given back
+    if (ptr && ptr == this->last) {
+        Block &block = this->blocks[this->current_block];
+        if ((uint8_t*)ptr + size == block.data + block.used) {
+            block.used = (uint8_t*)ptr - block.data;
+        }
+        this->last = nullptr;
+    }
+}
 
-    ColorYCbCrA operator+(const ColorYCbCrA& other);
-    ColorYCbCrA operator-(const ColorYCbCrA& other);
+void* ArenaAllocator::reallocate(void *ptr, size_t old_size, size_t new_size, size_t alignment) {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
 
-    ColorYCbCrA& operator*=(double k);
-    ColorYCbCrA& operator+=(const ColorYCbCrA& other);
-    ColorYCbCrA& operator-=(const ColorYCbCrA& other);
+        // the most recent allocation grows in place while it fits into its block
+        if (ptr && ptr == this->last) {
+            Block &block = this->blocks[this->current_block];
+            size_t start = (uint8_t*)ptr - block.data;
+            if (start + old_size == block.used && start + new_size <= block.size) {
+                block.used = start + new_size;
+                return ptr;
+            }
+        }
+    }
+    return ImageAllocator::reallocate(ptr, old_size, new_size, alignment);
+}
 
-    explicit operator ColorRGBA() const;
-};
-ColorYCbCrA operator*(double k, const ColorYCbCrA& pix);
-std::ostream& operator<<(std::ostream& os, const ColorYCbCrA& p);
+void ArenaAllocator::reset() {
+    std::lock_guard<std::mutex> guard(this->lock);
 
-#endif //STB_IMAGE_WRAPPER_INCLUDE
+    for (Block &block: this->blocks) {
+        block.used = 0;
+    }
+    this->current_block = 0;
+    this->last = nullptr;
+}
 
+void ArenaAllocator::release() {
+    std::lock_guard<std::mutex> guard(this->lock);
 
+    for (Block &block: this->blocks) {
+        ::operator delete(block.data, std::align_val_t(64));
+    }
+    this->blocks.clear();
+    this->current_block = 0;
+    this->last = nullptr;
+}
 
+size_t ArenaAllocator::used() {
+    std::lock_guard<std::mutex> guard(this->lock);
 
+    size_t total = 0;
+    for (const Block &block: this->blocks) total += block.used;
+    return total;
+}
 
+size_t ArenaAllocator::capacity() {
+    std::lock_guard<std::mutex> guard(this->lock);
 
+    size_t total = 0;
+    for (const Block &block: this->blocks) total += block.size;
+    return total;
+}
 
+// class 0 is up to 256 bytes, then every power of 2 is split into 4 classes: 320, 384, 448, 512, 640, ...
+int PoolAllocator::size_class(size_t size) {
+    if (size <= 256) return 0;
+    int e = std::bit_width(size - 1) - 1;
+    size_t k = (size*4 + ((size_t)1 << e) - 1) >> e;
+    return (e - 8)*4 + (int)(k - 4);
+}
 
+size_t PoolAllocator::class_size(int size_class) {
+    if (size_class == 0) return 256;
+    int e = 8 + (size_class - 1)/4;
+    int k = (size_class - 1)%4 + 1;
+    return ((size_t)1 << e) / 4 * (4 + k);
+}
 
+PoolAllocator::PoolAllocator(size_t max_cached): max_cached(max_cached) {}
 
+PoolAllocator::~PoolAllocator() {
+    this->trim();
+}
 
+void* PoolAllocator::allocate(size_t size, size_t alignment) {
+    if (alignment > ALIGNMENT) {
+        return ::operator new(size, std::align_val_t(alignment));
+    }
 
+    int index = size_class(size);
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (index < (int)this->free_lists.size() && !this->free_lists[index].empty()) {
+            void *ptr = this->free_lists[index].back();
+            this->free_lists[index].pop_back();
+            this->cached_bytes -= class_size(index);
+            return ptr;
+        }
+    }
+    return ::operator new(class_size(index), std::align_val_t(ALIGNMENT));
+}
 
+void PoolAllocator::deallocate(void *ptr, size_t size, size_t alignment) {
+    if (!ptr) return;
+    if (alignment > ALIGNMENT) {
+        ::operator delete(ptr, std::align_val_t(alignment));
+        return;
+    }
 
+    int index = size_class(size);
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (this->cached_bytes + class_size(index) <= this->max_cached) {
+            if (index >= (int)this->free_lists.size()) this->free_lists.resize(index + 1);
+            this->free_lists[index].push_back(ptr);
+            this->cached_bytes += class_size(index);
+            return;
+        }
+    }
+    ::operator delete(ptr, std::align_val_t(ALIGNMENT));
+}
 
-#ifdef STB_IMAGE_WRAPPER_IMPLEMENTATION
+void PoolAllocator::trim() {
+    std::lock_guard<std::mutex> guard(this->lock);
 
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-extern "C" {
-    #include "stb/stb_image.h"
-    #include "stb/stb_image_resize2.h"
-    #include "stb/stb_image_write.h"
+    for (std::vector<void*> &list: this->free_lists) {
+        for (void *ptr: list) {
+            ::operator delete(ptr, std::align_val_t(ALIGNMENT));
+        }
+        list.clear();
+    }
+    this->cached_bytes = 0;
 }
 
-Image::Image(const char* filepath, int desired_number_of_channels): owner(STB) {
-    this->data = stbi_load(filepath, &this->width, &this->height, &this->channels, desired_number_of_channels);
-    if (!this->data) {
-        throw std::runtime_error("Cannot load image " + std::string(filepath));
+size_t PoolAllocator::cached() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->cached_bytes;
+}
+
+static std::atomic<uint64_t> next_image_pool_id{1};
+
+// caches of this thread for every pool it used (ids are never reused, so entries of destroyed pools never match)
+static thread_local std::vector<std::pair<uint64_t, std::shared_ptr<void>>> image_pool_thread_caches;
+
+ImagePool::ImagePool(size_t high_water, int thread_cache_size): 
+    id(next_image_pool_id++), high_water(high_water), thread_cache_size(thread_cache_size) {}
+
+ImagePool::~ImagePool() {
+    this->trim();
+    std::lock_guard<std::mutex> guard(this->lock);
+    for (auto &cache: this->thread_caches) {
+        std::lock_guard<std::mutex> cache_guard(cache->lock);
+        cache->closed = true;
     }
-    this->channels = desired_number_of_channels;
 }
 
-Image::Image(const std::string &filepath, int desired_number_of_channels): owner(STB) {
-    this->data = stbi_load(filepath.c_str(), &this->width, &this->height, &this->channels, desired_number_of_channels);
-    if (!this->data) {
-        throw std::runtime_error("Cannot load image " + filepath);
+ImagePool::ThreadCache& ImagePool::thread_cache() {
+    for (auto &entry: image_pool_thread_caches) {
+        if (entry.first == this->id) return *(ThreadCache*)entry.second.get();
+    }
+
+    // forget caches of destroyed pools
+    std::erase_if(image_pool_thread_caches, [](const auto &entry) {
+        ThreadCache *cache = (ThreadCache*)entry.second.get();
+        std::lock_guard<std::mutex> guard(cache->lock);
+        return cache->closed;
+    });
+
+    auto cache = std::make_shared<ThreadCache>();
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->thread_caches.push_back(cache);
     }
-    this->channels = desired_number_of_channels;
+    image_pool_thread_caches.emplace_back(this->id, cache);
+    return *cache;
 }
 
-Image::Image(int width, int height, int channels): owner(LOCAL) {
-    assert(width>0);
-    assert(height>0);
-    assert(channels>0);
+Image ImagePool::acquire(int width, int height, int channels, Image::SampleType sample, int alignment) {
+    AllocatorScope scope(*this);
+    return Image(width, height, channels, sample, alignment);
+}
 
-    this->width = width;
-    this->height = height;
-    this->channels = channels;
+void* ImagePool::allocate(size_t size, size_t alignment) {
+    auto key = std::make_pair(size, alignment);
+    void *ptr = nullptr;
+
+    ThreadCache &cache = this->thread_cache();
+    {
+        std::lock_guard<std::mutex> guard(cache.lock);
+        auto it = cache.buffers.find(key);
+        if (it != cache.buffers.end() && !it->second.empty()) {
+            ptr = it->second.back();
+            it->second.pop_back();
+        }
+    }
+    if (!ptr) {
+        std::lock_guard<std::mutex> guard(this->lock);
+        auto it = this->buffers.find(key);
+        if (it != this->buffers.end() && !it->second.empty()) {
+            ptr = it->second.back();
+            it->second.pop_back();
+        }
+    }
 
-    this->data = new uint8_t[width*height*channels];
+    if (ptr) {
+        this->hits++;
+        this->cached_bytes -= size;
+        this->cached_buffers--;
+        return ptr;
+    }
+    this->misses++;
+    return ::operator new(size, std::align_val_t(alignment));
 }
 
-Image::~Image() {
-    if (this->data) {
-        switch (this->owner) {
-        case NONE:
-            break;
-        case LOCAL:
-            delete this->data;
-            break;
-        case STB:
-            stbi_image_free(this->data);
-            break;
+void ImagePool::deallocate(void *ptr, size_t size, size_t alignment) {
+    if (!ptr) return;
 
-        default:
-            std::cerr << "Not handled owner type " << this->owner << std::endl;
-            break;
+    // bytes are reserved before the buffer is cached, so concurrent frees cannot cache past high_water together
+    size_t cached = this->cached_bytes.load(std::memory_order_relaxed);
+    do {
+        if (cached + size > this->high_water || cached + size < cached) {
+            ::operator delete(ptr, std::align_val_t(alignment));
+            return;
+        }
+    } while (!this->cached_bytes.compare_exchange_weak(cached, cached + size, std::memory_order_relaxed));
+    this->cached_buffers++;
+
+    auto key = std::make_pair(size, alignment);
+    ThreadCache &cache = this->thread_cache();
+    {
+        std::lock_guard<std::mutex> guard(cache.lock);
+        std::vector<void*> &list = cache.buffers[key];
+        if ((int)list.size() < this->thread_cache_size) {
+            list.push_back(ptr);
+            return;
         }
+    }
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->buffers[key].push_back(ptr);
+}
 
-        this->data = NULL;
-        this->owner = NONE;
+void ImagePool::free_buffers(FreeLists &lists, size_t &keep_bytes) {
+    for (auto &[key, list]: lists) {
+        while (!list.empty() && this->cached_bytes > keep_bytes) {
+            ::operator delete(list.back(), std::align_val_t(key.second));
+            list.pop_back();
+            this->cached_bytes -= key.first;
+            this->cached_buffers--;
+        }
     }
 }
 
-Image::Image(const Image &other) {
-    if (this != &other) {
-        this->width = other.width;
-        this->height = other.height;
-        this->channels = other.channels;
+void ImagePool::trim(size_t keep_bytes) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->free_buffers(this->buffers, keep_bytes);
+    for (auto &cache: this->thread_caches) {
+        std::lock_guard<std::mutex> cache_guard(cache->lock);
+        this->free_buffers(cache->buffers, keep_bytes);
+    }
+}
 
-        this->owner = LOCAL;
+ImagePoolStats ImagePool::stats() const {
+    ImagePoolStats stats;
+    stats.hits = this->hits;
+    stats.misses = this->misses;
+    stats.cached_bytes = this->cached_bytes;
+    stats.cached_buffers = this->cached_buffers;
+    return stats;
+}
+
+AllocatorScope::AllocatorScope(ImageAllocator &allocator): previous(scoped_image_allocator) {
+    scoped_image_allocator = &allocator;
+}
+
+AllocatorScope::~AllocatorScope() {
+    scoped_image_allocator = this->previous;
+}
 
-        this->data = new uint8_t[width*height*channels];
-        memcpy(this->data, other.data, width*height*channels);
+
+
+static thread_local bool inside_pool_task = false;
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+
+    for (int i=1; i<threads; i++) {
+        this->workers.emplace_back(&ThreadPool::worker_loop, this);
     }
 }
 
-Image::Image(Image &&other) {
-    if (this != &other) {
-        this->width = other.width;
-        this->height = other.height;
-        this->channels = other.channels;
-        
-        this->owner = other.owner;
-        other.owner = NONE;
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    for (auto &worker: this->workers) {
+        worker.join();
+    }
+}
 
-        this->data = other.data;
-        other.data = NULL;
+int ThreadPool::size() const {
+    return this->workers.size() + 1;
+}
+
+void ThreadPool::run_tasks() {
+    bool was_inside = inside_pool_task;
+    inside_pool_task = true;
+    int i;
+    while ((i = this->next_index.fetch_add(1)) < this->task_count) {
+        try {
+            (*this->task)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            if (!this->error) this->error = std::current_exception();
+        }
     }
+    inside_pool_task = was_inside;
 }
 
-Image& Image::operator=(const Image &other) {
-    if (this != &other) {
-        this->width = other.width;
-        this->height = other.height;
-        this->channels = other.channels;
-        
-        if (this->data) {
-            delete this->data;
+void ThreadPool::worker_loop() {
+    unsigned long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->wake.wait(guard, [&]{ return this->stopping || this->generation != seen; });
+            if (this->stopping) return;
+            seen = this->generation;
         }
 
-        this->owner = LOCAL;
+        this->run_tasks();
 
-        this->data = new uint8_t[width*height*channels];
-        memcpy(this->data, other.data, width*height*channels);
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->active_workers--;
+            if (this->active_workers == 0) this->done.notify_one();
+        }
     }
-    return *this;
 }
 
-Image& Image::operator=(Image &&other) {
-    if (this != &other) {
-        this->width = other.width;
-        this->height = other.height;
-        this->channels = other.channels;
+void ThreadPool::parallel_for(int count, const std::function<void(int)> &fn) {
+    if (count <= 0) return;
+    if (count == 1 || this->workers.empty() || inside_pool_task) {
+        for (int i=0; i<count; i++) fn(i);
+        return;
+    }
 
-        this->owner = other.owner;
-        other.owner = NONE;
+    std::lock_guard<std::mutex> run_guard(this->run_lock);
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->task = &fn;
+        this->task_count = count;
+        this->next_index = 0;
+        this->active_workers = this->workers.size();
+        this->error = nullptr;
+        this->generation++;
+    }
+    this->wake.notify_all();
 
-        this->data = other.data;
-        other.data = NULL;
+    this->run_tasks();
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->done.wait(guard, [&]{ return this->active_workers == 0; });
+        this->task = nullptr;
+        error = this->error;
+        this->error = nullptr;
     }
-    return *this;
+    if (error) std::rethrow_exception(error);
 }
 
-int Image::save_jpg(const char* filepath, int quality) {
-    return stbi_write_jpg(filepath, this->width, this->height, this->channels, this->data, quality);
-}
-int Image::save_jpg(const std::string &filepath, int quality) {
-    return stbi_write_jpg(filepath.c_str(), this->width, this->height, this->channels, this->data, quality);
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
 }
 
-int Image::save_png(const char* filepath) {
-    return stbi_write_png(filepath, this->width, this->height, this->channels, this->data, width * channels);
-}
-int Image::save_png(const std::string &filepath) {
-    return stbi_write_png(filepath.c_str(), this->width, this->height, this->channels, this->data, width * channels);
-}
+void parallel_for_bands(int height, size_t row_bytes, const std::function<void(int, int)> &fn, ThreadPool &pool) {
+    if (height <= 0) return;
+    if (row_bytes*height < PARALLEL_MIN_BYTES || pool.size() == 1) {
+        fn(0, height);
+        return;
+    }
 
-uint8_t* Image::at(int x, int y) {
-    if (x < 0 || x >= this->width) throw std::range_error("x is out of range: " + std::to_string(x));
-    if (y < 0 || y >= this->height) throw std::range_error("y is out of range: " + std::to_string(y));
-    
-    return this->data + (x + this->width * y) * this->channels;
+    int band_rows = std::max<int>(1, PARALLEL_BAND_BYTES / std::max<size_t>(row_bytes, 1));
+    int bands = (height + band_rows - 1) / band_rows;
+    pool.parallel_for(bands, [&](int band) {
+        fn(band*band_rows, std::min(height, (band+1)*band_rows));
+    });
 }
 
-const uint8_t* Image::at(int x, int y) const {
-    if (x < 0 || x >= this->width) throw std::range_error("x is out of range: " + std::to_string(x));
-    if (y < 0 || y >= this->height) throw std::range_error("y is out of range: " + std::to_string(y));
-    
-    return this->data + (x + this->width * y) * this->channels;
+void parallel_for_ranges(int count, size_t bytes, const std::function<void(int, int)> &fn, ThreadPool &pool) {
+    if (count <= 0) return;
+    if (bytes < PARALLEL_MIN_BYTES || pool.size() == 1) {
+        fn(0, count);
+        return;
+    }
+    int ranges = std::min(count, pool.size()*4);
+    pool.parallel_for(ranges, [&](int i) {
+        fn((int)((int64_t)count*i/ranges), (int)((int64_t)count*(i + 1)/ranges));
+    });
 }
 
 
@@ -576,6 +2858,49 @@ PixelRGBA& PixelRGBA::operator-=(const PixelRGBA& other) {
 
 
 
+PixelGray16::PixelGray16(uint16_t value): value(value) {}
+
+std::ostream& operator<<(std::ostream& os, const PixelGray16& p) {
+    os << "{value: " << p.value << "}";
+    return os;
+}
+
+PixelRGB16::PixelRGB16(uint16_t r, uint16_t g, uint16_t b): r(r), g(g), b(b) {}
+
+std::ostream& operator<<(std::ostream& os, const PixelRGB16& p) {
+    os << "{r: " << p.r << ", g: " << p.g << ", b: " << p.b << "}";
+    return os;
+}
+
+PixelRGBA16::PixelRGBA16(uint16_t r, uint16_t g, uint16_t b, uint16_t a): PixelRGB16(r, g, b), a(a) {}
+
+std::ostream& operator<<(std::ostream& os, const PixelRGBA16& p) {
+    os << "{r: " << p.r << ", g: " << p.g << ", b: " << p.b << ", a: " << p.a << "}";
+    return os;
+}
+
+PixelGrayF::PixelGrayF(float value): value(value) {}
+
+std::ostream& operator<<(std::ostream& os, const PixelGrayF& p) {
+    os << "{value: " << p.value << "}";
+    return os;
+}
+
+PixelRGBF::PixelRGBF(float r, float g, float b): r(r), g(g), b(b) {}
+
+std::ostream& operator<<(std::ostream& os, const PixelRGBF& p) {
+    os << "{r: " << p.r << ", g: " << p.g << ", b: " << p.b << "}";
+    return os;
+}
+
+PixelRGBAF::PixelRGBAF(float r, float g, float b, float a): PixelRGBF(r, g, b), a(a) {}
+
+std::ostream& operator<<(std::ostream& os, const PixelRGBAF& p) {
+    os << "{r: " << p.r << ", g: " << p.g << ", b: " << p.b << ", a: " << p.a << "}";
+    return os;
+}
+
+
 
 ColorRGBA::ColorRGBA(): r(0), g(0), b(0) {}
 ColorRGBA::ColorRGBA(double r, double g, double b): r(r), g(g), b(b) {}
@@ -700,8 +3025,50 @@ ColorRGBA::operator ColorYCbCrA() const {
 }
 
 
+static SRGBTables make_srgb_tables() {
+    SRGBTables t;
+    auto decode = [](double v) {
+        return v <= 0.04045 ? v/12.92 : pow((v + 0.055)/1.055, 2.4);
+    };
+    for (int i=0; i<256; i++) {
+        t.decode[i] = (float)decode(i/255.0);
+    }
+    t.threshold[0] = 0;
+    for (int k=1; k<256; k++) {
+        t.threshold[k] = (float)decode((k - 0.5)/255.0);
+    }
+    t.threshold[256] = 2;
+    int code = 0;
+    for (int i=0; i<4096; i++) {
+        float v = i/4095.0f;
+        while (v >= t.threshold[code + 1]) code++;
+        t.encode[i] = code;
+    }
+    return t;
+}
+
+const SRGBTables srgb_tables = make_srgb_tables();
+
 double ColorYCbCrA::Kr = 0.299;
 double ColorYCbCrA::Kb = 0.114;
+
+YCbCrSpace YCbCrSpace::current() {
+    return YCbCrSpace(ColorYCbCrA::Kr, ColorYCbCrA::Kb);
+}
+
+ColorRGBA::ColorRGBA(const ColorYCbCrA& ycbcra, const YCbCrSpace& space) {
+    const double (*m)[3] = space.to_rgb();
+    r = ycbcra.y + m[0][2]*ycbcra.cr;
+    g = ycbcra.y + m[1][1]*ycbcra.cb + m[1][2]*ycbcra.cr;
+    b = ycbcra.y + m[2][1]*ycbcra.cb;
+}
+
+ColorYCbCrA::ColorYCbCrA(const ColorRGBA& clr, const YCbCrSpace& space) {
+    const double (*m)[3] = space.to_ycbcr();
+    y = m[0][0]*clr.r + m[0][1]*clr.g + m[0][2]*clr.b;
+    cb = m[1][0]*clr.r + m[1][1]*clr.g + m[1][2]*clr.b;
+    cr = m[2][0]*clr.r + m[2][1]*clr.g + m[2][2]*clr.b;
+}
 ColorYCbCrA::ColorYCbCrA(): y(0), cb(0), cr(0) {}
 ColorYCbCrA::ColorYCbCrA(double y, double cb, double cr): y(y), cb(cb), cr(cr) {}
 ColorYCbCrA::ColorYCbCrA(double y, double cb, double cr, double a): y(y), cb(cb), cr(cr), a(a) {}
@@ -757,5 +3124,15 @@ std::ostream& operator<<(std::ostream& os, const ColorYCbCrA& p) {
     return os;
 }
 
+std::ostream& operator<<(std::ostream& os, const ColorRGBAf& c) {
+    os << "{r: " << c.r << ", g: " << c.g << ", b: " << c.b << ", a: " << c.a << "}";
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const ColorYCbCrAf& p) {
+    os << "{Y: " << p.y << ", Cb: " << p.cb << ", Cr: " << p.cr << ", A: " << p.a << "}";
+    return os;
+}
+
 
 #endif // STB_IMAGE_WRAPPER_IMPLEMENTATION
@@ -0,0 +1,623 @@
+#ifndef STB_IMAGE_WRAPPER_BLUR_INCLUDE
+#define STB_IMAGE_WRAPPER_BLUR_INCLUDE
+
+#include "image.hpp"
+#include <math.h>
+#include <optional>
+
+
+// Normalized Gaussian weights for offsets 0..radius (the kernel is symmetric),
+// computed once & reusable for any number of images
+struct GaussianKernel {
+    float sigma = 0;
+    int radius = 0;
+    std::vector<float> weights;
+
+    GaussianKernel() = default;
+    // radius defaults to ceil(3*sigma)
+    GaussianKernel(float sigma, int radius = -1);
+};
+
+// Radii of `passes` box blurs which together approximate Gaussian of sigma
+std::vector<int> gaussian_box_radii(float sigma, int passes = 3);
+
+// Blurs: src & dst of the same size, channels (1 to 4) & sample type, dst may be src (blur in place).
+// Pixels outside the image are the nearest edge pixels.
+// The image is blurred by column strips in parallel, rows of a strip are streamed through both passes in cache.
+void gaussian_blur(ConstImageView src, ImageView dst, const GaussianKernel &kernel, ThreadPool &pool = ThreadPool::shared());
+void gaussian_blur(ConstImageView src, ImageView dst, float sigma, ThreadPool &pool = ThreadPool::shared());
+
+// O(1) per pixel (running sums), independent of radius. Every radius is one box pass over rows & columns.
+void box_blur(ConstImageView src, ImageView dst, int radius, ThreadPool &pool = ThreadPool::shared());
+void box_blur(ConstImageView src, ImageView dst, std::span<const int> radii, ThreadPool &pool = ThreadPool::shared());
+
+// Gaussian approximated by 3 box passes (gaussian_box_radii), cost does not depend on sigma
+void fast_gaussian_blur(ConstImageView src, ImageView dst, float sigma, ThreadPool &pool = ThreadPool::shared());
+
+#endif // STB_IMAGE_WRAPPER_BLUR_INCLUDE
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+#ifdef STB_IMAGE_WRAPPER_BLUR_IMPLEMENTATION
+
+#if !defined(STB_IMAGE_WRAPPER_NO_SIMD)
+    #if defined(__AVX2__)
+        #define STB_IMAGE_WRAPPER_AVX2
+        #include <immintrin.h>
+    #elif defined(__SSE2__) || defined(_M_X64)
+        #define STB_IMAGE_WRAPPER_SSE2
+        #include <emmintrin.h>
+    #endif
+#endif
+
+// floats of a row accumulated at once by Gaussian passes, loaded or passed through vertical box passes at once
+static const int BLUR_TILE_FLOATS = 256;
+// preferred width of column strips in pixels: rings of rows of a strip fit L2 for usual radii,
+// while source rows are still read in runs long enough for the prefetcher
+static const int BLUR_STRIP_PIXELS = 1024;
+
+GaussianKernel::GaussianKernel(float sigma, int radius): sigma(sigma) {
+    if (!(sigma > 0)) throw std::invalid_argument("Gaussian sigma must be positive");
+    this->radius = radius >= 0 ? radius : (int)ceilf(3*sigma);
+    this->weights.resize(this->radius + 1);
+
+    double sum = 0;
+    for (int k=0; k<=this->radius; k++) {
+        double w = exp(-(double)k*k/(2.0*sigma*sigma));
+        this->weights[k] = (float)w;
+        sum += k ? 2*w : w;
+    }
+    for (float &w: this->weights) w = (float)(w/sum);
+}
+
+std::vector<int> gaussian_box_radii(float sigma, int passes) {
+    if (!(sigma > 0)) throw std::invalid_argument("Gaussian sigma must be positive");
+    assert(passes > 0);
+
+    // m passes of width wl & the rest of width wu = wl + 2 give variance closest to sigma^2
+    double ideal = sqrt(12.0*sigma*sigma/passes + 1);
+    int wl = (int)floor(ideal);
+    if (wl % 2 == 0) wl--;
+    int wu = wl + 2;
+    double m_ideal = (12.0*sigma*sigma - passes*wl*wl - 4.0*passes*wl - 3.0*passes)/(-4.0*wl - 4);
+    int m = (int)lround(m_ideal);
+
+    std::vector<int> radii(passes);
+    for (int i=0; i<passes; i++) radii[i] = ((i < m ? wl : wu) - 1)/2;
+    return radii;
+}
+
+// Row kernels over n floats
+#if defined(STB_IMAGE_WRAPPER_AVX2)
+
+// acc = w*a
+static void blur_scale(float *acc, const float *a, float w, int n) {
+    __m256 vw = _mm256_set1_ps(w);
+    int i = 0;
+    for (; i+8<=n; i+=8) _mm256_storeu_ps(acc + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), vw));
+    for (; i<n; i++) acc[i] = a[i]*w;
+}
+
+// acc += w*(a + b)
+static void blur_accumulate(float *acc, const float *a, const float *b, float w, int n) {
+    __m256 vw = _mm256_set1_ps(w);
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        __m256 s = _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(s, vw)));
+    }
+    for (; i<n; i++) acc[i] += w*(a[i] + b[i]);
+}
+
+// out = sum*k, sum += add - sub
+static void blur_box_step(float *out, float *sum, const float *add, const float *sub, float k, int n) {
+    __m256 vk = _mm256_set1_ps(k);
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        __m256 s = _mm256_loadu_ps(sum + i);
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(s, vk));
+        s = _mm256_add_ps(s, _mm256_sub_ps(_mm256_loadu_ps(add + i), _mm256_loadu_ps(sub + i)));
+        _mm256_storeu_ps(sum + i, s);
+    }
+    for (; i<n; i++) {
+        out[i] = sum[i]*k;
+        sum[i] += add[i] - sub[i];
+    }
+}
+
+#elif defined(STB_IMAGE_WRAPPER_SSE2)
+
+static void blur_scale(float *acc, const float *a, float w, int n) {
+    __m128 vw = _mm_set1_ps(w);
+    int i = 0;
+    for (; i+4<=n; i+=4) _mm_storeu_ps(acc + i, _mm_mul_ps(_mm_loadu_ps(a + i), vw));
+    for (; i<n; i++) acc[i] = a[i]*w;
+}
+
+static void blur_accumulate(float *acc, const float *a, const float *b, float w, int n) {
+    __m128 vw = _mm_set1_ps(w);
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m128 s = _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(s, vw)));
+    }
+    for (; i<n; i++) acc[i] += w*(a[i] + b[i]);
+}
+
+static void blur_box_step(float *out, float *sum, const float *add, const float *sub, float k, int n) {
+    __m128 vk = _mm_set1_ps(k);
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m128 s = _mm_loadu_ps(sum + i);
+        _mm_storeu_ps(out + i, _mm_mul_ps(s, vk));
+        s = _mm_add_ps(s, _mm_sub_ps(_mm_loadu_ps(add + i), _mm_loadu_ps(sub + i)));
+        _mm_storeu_ps(sum + i, s);
+    }
+    for (; i<n; i++) {
+        out[i] = sum[i]*k;
+        sum[i] += add[i] - sub[i];
+    }
+}
+
+#else
+
+static void blur_scale(float *acc, const float *a, float w, int n) {
+    for (int i=0; i<n; i++) acc[i] = a[i]*w;
+}
+
+static void blur_accumulate(float *acc, const float *a, const float *b, float w, int n) {
+    for (int i=0; i<n; i++) acc[i] += w*(a[i] + b[i]);
+}
+
+static void blur_box_step(float *out, float *sum, const float *add, const float *sub, float k, int n) {
+    for (int i=0; i<n; i++) {
+        out[i] = sum[i]*k;
+        sum[i] += add[i] - sub[i];
+    }
+}
+
+#endif
+
+// Pixels of a row segment [x_begin, x_end) outside [0, width) are set to the nearest edge pixel of the segment,
+// row[0] is the pixel x_begin. The segment must intersect the image.
+static void blur_clamp_segment(float *row, int x_begin, int x_end, int width, int channels) {
+    const float *left = row + (size_t)(0 - x_begin)*channels;
+    const float *right = row + (size_t)(width - 1 - x_begin)*channels;
+    for (int x=x_begin; x<std::min(0, x_end); x++) {
+        memcpy(row + (size_t)(x - x_begin)*channels, left, channels*sizeof(float));
+    }
+    for (int x=std::max(width, x_begin); x<x_end; x++) {
+        memcpy(row + (size_t)(x - x_begin)*channels, right, channels*sizeof(float));
+    }
+}
+
+// pixels [x_begin, x_end) of row y to floats, pixels outside the image are the nearest edge pixels
+static void blur_load_segment(ConstImageView src, int y, int x_begin, int x_end, float *out) {
+    int from = std::max(x_begin, 0), to = std::min(x_end, src.width);
+    load_sample_row(src.data + (size_t)y*src.stride + (size_t)from*src.pixel_size(), src.sample, 
+        out + (size_t)(from - x_begin)*src.channels, (to - from)*src.channels);
+    blur_clamp_segment(out, x_begin, x_end, src.width, src.channels);
+}
+
+// Blurs run by column strips: fn(x_begin, x_end) blurs all rows of the strip, streaming them through
+// rings of the rows vertical passes still need, so nothing of the image size is allocated & rows stay in cache.
+// halo is the number of pixels horizontal passes read on each side of a strip.
+static void blur_strips(ConstImageView src, int halo, const std::function<void(int, int)> &fn, ThreadPool &pool) {
+    int strip = std::max(BLUR_STRIP_PIXELS, 4*halo);
+    if (pool.size() > 1) {
+        // a strip per thread, unless they would be mostly halo: narrower strips cost more per pixel
+        strip = std::min(strip, std::max(2*halo, (src.width + pool.size() - 1) / pool.size()));
+    }
+    strip = std::clamp(strip, 1, src.width);
+    int strips = (src.width + strip - 1) / strip;
+
+    parallel_for_ranges(strips, (size_t)src.width*src.height*src.pixel_size(), [&](int begin, int end) {
+        for (int i=begin; i<end; i++) fn(i*strip, std::min(src.width, (i + 1)*strip));
+    }, pool);
+}
+
+// Ring of rows of a strip: row y is in slot y % capacity, rows [0, produced) were written
+struct BlurRing {
+    std::vector<float> data;
+    int capacity;
+    size_t len;
+    int produced = 0;
+
+    BlurRing(int capacity = 1, size_t len = 0): data((size_t)capacity*len), capacity(capacity), len(len) {}
+    float* row(int y) { return this->data.data() + (size_t)(y % this->capacity)*this->len; }
+
+    // empty ring of other size, the buffer is kept if it is big enough
+    void reset(int capacity, size_t len) {
+        this->data.resize(std::max(this->data.size(), (size_t)capacity*len));
+        this->capacity = capacity;
+        this->len = len;
+        this->produced = 0;
+    }
+};
+
+static void check_blur_images(ConstImageView src, ConstImageView dst) {
+    if (src.width != dst.width || src.height != dst.height || src.channels != dst.channels || src.sample != dst.sample) {
+        throw std::invalid_argument("Blur destination does not match source");
+    }
+    if (src.channels < 1 || src.channels > 4) {
+        throw std::invalid_argument("Blur expects 1 to 4 channels, got " + std::to_string(src.channels));
+    }
+}
+
+void gaussian_blur(ConstImageView src, ImageView dst, const GaussianKernel &kernel, ThreadPool &pool) {
+    check_blur_images(src, dst);
+    if (src.width == 0 || src.height == 0) return;
+    std::optional<Image> copy;
+    src = unaliased_source(src, dst, copy);
+
+    const int C = src.channels, R = kernel.radius;
+    const float *w = kernel.weights.data();
+
+    blur_strips(src, R, [&](int x0, int x1) {
+        const int n = (x1 - x0)*C;
+        std::vector<float> line((size_t)(x1 - x0 + 2*R)*C), acc(n);
+        BlurRing rows(std::min(2*R + 1, src.height), n);
+
+        // horizontal pass by tiles, so the accumulated part of the row stays in L1
+        auto horizontal = [&](int y) {
+            blur_load_segment(src, y, x0 - R, x1 + R, line.data());
+            const float *in = line.data() + R*C;
+            float *out = rows.row(y);
+            for (int t=0; t<n; t+=BLUR_TILE_FLOATS) {
+                int len = std::min(BLUR_TILE_FLOATS, n - t);
+                blur_scale(out + t, in + t, w[0], len);
+                for (int k=1; k<=R; k++) blur_accumulate(out + t, in + t - k*C, in + t + k*C, w[k], len);
+            }
+        };
+        auto row = [&](int y) { return rows.row(std::clamp(y, 0, src.height - 1)); };
+
+        for (int y=0; y<src.height; y++) {
+            for (int need=std::min(y + R, src.height - 1); rows.produced <= need; rows.produced++) horizontal(rows.produced);
+
+            for (int t=0; t<n; t+=BLUR_TILE_FLOATS) {
+                int len = std::min(BLUR_TILE_FLOATS, n - t);
+                blur_scale(acc.data() + t, row(y) + t, w[0], len);
+                for (int k=1; k<=R; k++) blur_accumulate(acc.data() + t, row(y - k) + t, row(y + k) + t, w[k], len);
+            }
+            store_sample_row(acc.data(), dst.data + (size_t)y*dst.stride + (size_t)x0*dst.pixel_size(), dst.sample, n);
+        }
+    }, pool);
+}
+
+void gaussian_blur(ConstImageView src, ImageView dst, float sigma, ThreadPool &pool) {
+    gaussian_blur(src, dst, GaussianKernel(sigma), pool);
+}
+
+// Horizontal box passes run on BLUR_LANES rows at once, one row per SIMD lane:
+// values of the rows are interleaved as [x][channel][row], so running sums are vectors without transposing them back per pixel.
+#if defined(STB_IMAGE_WRAPPER_AVX2) || defined(STB_IMAGE_WRAPPER_SSE2)
+static const int BLUR_LANES = 4;
+
+static void blur_interleave_lanes(const float *const rows[BLUR_LANES], float *out, int n) {
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m128 a = _mm_loadu_ps(rows[0] + i), b = _mm_loadu_ps(rows[1] + i), c = _mm_loadu_ps(rows[2] + i), d = _mm_loadu_ps(rows[3] + i);
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+        _mm_storeu_ps(out + 4*i, a);
+        _mm_storeu_ps(out + 4*i + 4, b);
+        _mm_storeu_ps(out + 4*i + 8, c);
+        _mm_storeu_ps(out + 4*i + 12, d);
+    }
+    for (; i<n; i++) {
+        for (int l=0; l<4; l++) out[4*i + l] = rows[l][i];
+    }
+}
+
+static void blur_deinterleave_lanes(const float *in, float *const rows[BLUR_LANES], int n) {
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m128 a = _mm_loadu_ps(in + 4*i), b = _mm_loadu_ps(in + 4*i + 4), c = _mm_loadu_ps(in + 4*i + 8), d = _mm_loadu_ps(in + 4*i + 12);
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+        _mm_storeu_ps(rows[0] + i, a);
+        _mm_storeu_ps(rows[1] + i, b);
+        _mm_storeu_ps(rows[2] + i, c);
+        _mm_storeu_ps(rows[3] + i, d);
+    }
+    for (; i<n; i++) {
+        for (int l=0; l<4; l++) rows[l][i] = in[4*i + l];
+    }
+}
+
+// one box pass: out[x] = k * sum of in[x-r .. x+r], reads in[-r .. width+r] (x in pixels of C*4 floats)
+template<int C>
+static void box_blur_lanes(const float *in, float *out, int width, int r, float scale) {
+    const int P = C*4;
+    __m128 k = _mm_set1_ps(scale);
+    __m128 s0 = _mm_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+    for (int i=-r; i<=r; i++) {
+        const float *p = in + i*P;
+        s0 = _mm_add_ps(s0, _mm_loadu_ps(p));
+        if (C > 1) s1 = _mm_add_ps(s1, _mm_loadu_ps(p + 4));
+        if (C > 2) s2 = _mm_add_ps(s2, _mm_loadu_ps(p + 8));
+        if (C > 3) s3 = _mm_add_ps(s3, _mm_loadu_ps(p + 12));
+    }
+    const float *add = in + (r + 1)*P, *sub = in - r*P;
+    for (int x=0; x<width; x++, out+=P, add+=P, sub+=P) {
+        _mm_storeu_ps(out, _mm_mul_ps(s0, k));
+        s0 = _mm_add_ps(s0, _mm_sub_ps(_mm_loadu_ps(add), _mm_loadu_ps(sub)));
+        if (C > 1) {
+            _mm_storeu_ps(out + 4, _mm_mul_ps(s1, k));
+            s1 = _mm_add_ps(s1, _mm_sub_ps(_mm_loadu_ps(add + 4), _mm_loadu_ps(sub + 4)));
+        }
+        if (C > 2) {
+            _mm_storeu_ps(out + 8, _mm_mul_ps(s2, k));
+            s2 = _mm_add_ps(s2, _mm_sub_ps(_mm_loadu_ps(add + 8), _mm_loadu_ps(sub + 8)));
+        }
+        if (C > 3) {
+            _mm_storeu_ps(out + 12, _mm_mul_ps(s3, k));
+            s3 = _mm_add_ps(s3, _mm_sub_ps(_mm_loadu_ps(add + 12), _mm_loadu_ps(sub + 12)));
+        }
+    }
+}
+
+#else
+static const int BLUR_LANES = 1;
+
+static void blur_interleave_lanes(const float *const rows[BLUR_LANES], float *out, int n) {
+    memcpy(out, rows[0], n*sizeof(float));
+}
+
+static void blur_deinterleave_lanes(const float *in, float *const rows[BLUR_LANES], int n) {
+    memcpy(rows[0], in, n*sizeof(float));
+}
+
+// (sums are separate variables, an array of them is kept in memory by compilers)
+template<int C>
+static void box_blur_lanes(const float *in, float *out, int width, int r, float k) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i=-r; i<=r; i++) {
+        const float *p = in + i*C;
+        s0 += p[0];
+        if (C > 1) s1 += p[1];
+        if (C > 2) s2 += p[2];
+        if (C > 3) s3 += p[3];
+    }
+    const float *add = in + (r + 1)*C, *sub = in - r*C;
+    for (int x=0; x<width; x++, out+=C, add+=C, sub+=C) {
+        out[0] = s0*k;
+        s0 += add[0] - sub[0];
+        if (C > 1) { out[1] = s1*k; s1 += add[1] - sub[1]; }
+        if (C > 2) { out[2] = s2*k; s2 += add[2] - sub[2]; }
+        if (C > 3) { out[3] = s3*k; s3 += add[3] - sub[3]; }
+    }
+}
+#endif
+
+static void box_blur_lanes(const float *in, float *out, int width, int channels, int r, float k) {
+    switch (channels) {
+    case 1: box_blur_lanes<1>(in, out, width, r, k); break;
+    case 2: box_blur_lanes<2>(in, out, width, r, k); break;
+    case 3: box_blur_lanes<3>(in, out, width, r, k); break;
+    case 4: box_blur_lanes<4>(in, out, width, r, k); break;
+    }
+}
+
+// Box passes of one strip. Stage 0 are rows after all horizontal passes, stage i - after i vertical passes.
+// Rows are produced on demand: a vertical pass asks the previous stage for the rows it needs,
+// so every stage keeps only 2*r + 2 rows of the next pass radius (stage 0 - plus a group of BLUR_LANES rows).
+// Once the first rows are there, output() runs all vertical passes together (see there).
+// Every pass treats pixels outside the image as the nearest edge pixels of its input.
+// Buffers are kept between strips & calls, one strip per thread (see local()).
+struct BoxBlurStrip {
+    // rows of one vertical pass step: out = sum*k, sum += add - sub
+    struct Step {
+        float *out, *sum;
+        const float *add, *sub;
+        float k;
+    };
+
+    ConstImageView src;
+    std::span<const int> radii;
+    int x0 = 0, x1 = 0, halo = 0;
+    size_t len = 0;
+    // tiles: BLUR_LANES tiles of source rows being loaded, then a tile of the last stage being stored
+    std::vector<float> tiles, line_a, line_b, sums;
+    std::vector<BlurRing> stages;
+    // lead[i]: rows stage i runs ahead of the output, for output row y pass i + 1 reads rows of stage i up to y + lead[i]
+    std::vector<int> lead;
+    std::vector<Step> steps;
+
+    void reset(ConstImageView src, std::span<const int> radii, int x0, int x1, int halo) {
+        this->src = src;
+        this->radii = radii;
+        this->x0 = x0;
+        this->x1 = x1;
+        this->halo = halo;
+        this->len = (size_t)(x1 - x0)*src.channels;
+        size_t line = (size_t)(x1 - x0 + 2*halo)*src.channels*BLUR_LANES;
+        this->tiles.resize(std::max(this->tiles.size(), (size_t)BLUR_TILE_FLOATS*BLUR_LANES));
+        this->line_a.resize(std::max(this->line_a.size(), line));
+        this->line_b.resize(std::max(this->line_b.size(), line));
+        this->sums.resize(std::max(this->sums.size(), radii.size()*this->len));
+        this->stages.resize(radii.size() + 1);
+        this->lead.resize(radii.size() + 1);
+        this->lead[radii.size()] = 0;
+        for (size_t i=radii.size(); i-->0; ) this->lead[i] = this->lead[i + 1] + radii[i] + 1;
+        this->steps.resize(radii.size() + 1);
+        for (size_t i=0; i<=radii.size(); i++) {
+            int capacity = 1;
+            if (i < radii.size()) capacity = std::min(2*radii[i] + 2 + (i ? 0 : BLUR_LANES), src.height);
+            this->stages[i].reset(capacity, this->len);
+        }
+    }
+
+    static BoxBlurStrip& local() {
+        static thread_local BoxBlurStrip strip;
+        return strip;
+    }
+
+    float* row(int stage, int y) {
+        return this->stages[stage].row(std::clamp(y, 0, this->src.height - 1));
+    }
+
+    void ensure(int stage, int y) {
+        y = std::min(y, this->src.height - 1);
+        BlurRing &ring = this->stages[stage];
+        while (ring.produced <= y) {
+            if (stage) {
+                this->vertical(stage, ring.produced, ring.row(ring.produced));
+                ring.produced++;
+            } else {
+                ring.produced = this->horizontal(ring.produced);
+            }
+        }
+    }
+
+    // Rows [y, y + BLUR_LANES) to stage 0, returns the next row to produce.
+    // Every pass is computed over pixels the next passes still read, line[0] is the pixel x0 - halo.
+    // Sums are divided only by the last pass, so integer samples stay exact in float (while sums are below 2^24)
+    // and results do not depend on where strips begin.
+    int horizontal(int y) {
+        const int C = this->src.channels;
+        const int L = BLUR_LANES;
+        const int x_begin = this->x0 - this->halo, x_end = this->x1 + this->halo;
+        int end = std::min(y + L, this->src.height);
+
+        // pixels of the image are loaded & interleaved by tiles, which stay in L1, the ones outside it are clamped after
+        float *a = this->line_a.data(), *b = this->line_b.data();
+        int from = std::max(x_begin, 0), n = (std::min(x_end, this->src.width) - from)*C;
+        for (int i=0; i<n; i+=BLUR_TILE_FLOATS) {
+            int tile = std::min(BLUR_TILE_FLOATS, n - i);
+            float *lanes[L];
+            for (int l=0; l<L; l++) {
+                lanes[l] = this->tiles.data() + (size_t)l*BLUR_TILE_FLOATS;
+                // rows past the end repeat the last one
+                if (l == 0 || y + l < end) {
+                    const uint8_t *p = this->src.data + (size_t)(y + l)*this->src.stride + ((size_t)from*C + i)*this->src.sample;
+                    load_sample_row(p, this->src.sample, lanes[l], tile);
+                } else {
+                    lanes[l] = lanes[l - 1];
+                }
+            }
+            blur_interleave_lanes(lanes, a + ((size_t)(from - x_begin)*C + i)*L, tile);
+        }
+        blur_clamp_segment(a, x_begin, x_end, this->src.width, C*L);
+
+        int rem = this->halo;
+        double area = 1;
+        for (size_t i=0; i<this->radii.size(); i++) {
+            int r = this->radii[i];
+            area *= 2*r + 1;
+            rem -= r + 1;
+            size_t offset = (size_t)(this->halo - rem)*C*L;
+            box_blur_lanes(a + offset, b + offset, this->x1 - this->x0 + 2*rem, C, r, i + 1 < this->radii.size() ? 1.0f : (float)(1/area));
+            blur_clamp_segment(b + offset, this->x0 - rem, this->x1 + rem, this->src.width, C*L);
+            std::swap(a, b);
+        }
+
+        float *out[L];
+        // rows past the end go to line b, which is free by now
+        for (int l=0; l<L; l++) out[l] = y + l < end ? this->stages[0].row(y + l) : b + (size_t)l*this->len;
+        blur_deinterleave_lanes(a + (size_t)this->halo*C*L, out, (int)this->len);
+        return end;
+    }
+
+    // sum of rows of stage - 1 around row 0 of stage
+    void start(int stage) {
+        int r = this->radii[stage - 1];
+        float *sum = this->sums.data() + (stage - 1)*this->len;
+        this->ensure(stage - 1, r);
+        blur_scale(sum, this->row(stage - 1, 0), 1, this->len);
+        for (int i=1; i<=r; i++) blur_accumulate(sum, this->row(stage - 1, -i), this->row(stage - 1, i), 1, this->len);
+    }
+
+    Step step(int stage, int y, float *out) {
+        int r = this->radii[stage - 1];
+        return {out, this->sums.data() + (stage - 1)*this->len, this->row(stage - 1, y + r + 1), this->row(stage - 1, y - r), 1.0f/(2*r + 1)};
+    }
+
+    void vertical(int stage, int y, float *out) {
+        int r = this->radii[stage - 1];
+        if (y == 0) this->start(stage);
+        this->ensure(stage - 1, y + r + 1);
+        Step s = this->step(stage, y, out);
+        blur_box_step(s.out, s.sum, s.add, s.sub, s.k, this->len);
+    }
+
+    // Row y of the last stage to dst (in the order of rows). Along with it every other stage produces the row
+    // the next pass adds to its sums, so all vertical passes run together tile by tile: a row is handed
+    // to the next pass while it is in L1 & results are stored straight from a tile.
+    void output(int y, ImageView dst) {
+        const int S = this->radii.size();
+        if (y == 0) {
+            if (S > 1) this->ensure(S - 1, this->lead[S - 1] - 1);
+            this->start(S);
+        }
+        this->ensure(0, y + this->lead[0]);
+
+        // stages past the last row only repeat it
+        int first = S;
+        while (first > 1 && y + this->lead[first - 1] < this->src.height) first--;
+        for (int i=first; i<S; i++) this->steps[i] = this->step(i, y + this->lead[i], this->stages[i].row(y + this->lead[i]));
+        this->steps[S] = this->step(S, y, this->tiles.data());
+
+        uint8_t *out = dst.data + (size_t)y*dst.stride + (size_t)this->x0*dst.pixel_size();
+        for (size_t t=0; t<this->len; t+=BLUR_TILE_FLOATS) {
+            int n = std::min((size_t)BLUR_TILE_FLOATS, this->len - t);
+            for (int i=first; i<S; i++) {
+                const Step &s = this->steps[i];
+                blur_box_step(s.out + t, s.sum + t, s.add + t, s.sub + t, s.k, n);
+            }
+            const Step &s = this->steps[S];
+            blur_box_step(s.out, s.sum + t, s.add + t, s.sub + t, s.k, n);
+            store_sample_row(s.out, out + t*dst.sample, dst.sample, n);
+        }
+        for (int i=first; i<S; i++) this->stages[i].produced++;
+    }
+};
+
+void box_blur(ConstImageView src, ImageView dst, std::span<const int> radii, ThreadPool &pool) {
+    check_blur_images(src, dst);
+    for (int r: radii) {
+        if (r < 0) throw std::invalid_argument("Box blur radius must not be negative");
+    }
+    if (src.width == 0 || src.height == 0) return;
+    std::optional<Image> copy;
+    src = unaliased_source(src, dst, copy);
+    if (radii.empty()) {
+        for (int y=0; y<src.height; y++) {
+            memcpy(dst.data + (size_t)y*dst.stride, src.data + (size_t)y*src.stride, (size_t)src.width*src.pixel_size());
+        }
+        return;
+    }
+
+    int halo = 0;
+    for (int r: radii) halo += r + 1;
+
+    blur_strips(src, halo, [&](int x0, int x1) {
+        BoxBlurStrip &strip = BoxBlurStrip::local();
+        strip.reset(src, radii, x0, x1, halo);
+        for (int y=0; y<src.height; y++) strip.output(y, dst);
+    }, pool);
+}
+
+void box_blur(ConstImageView src, ImageView dst, int radius, ThreadPool &pool) {
+    box_blur(src, dst, std::span<const int>(&radius, 1), pool);
+}
+
+void fast_gaussian_blur(ConstImageView src, ImageView dst, float sigma, ThreadPool &pool) {
+    std::vector<int> radii = gaussian_box_radii(sigma, 3);
+    box_blur(src, dst, radii, pool);
+}
+
+#endif // STB_IMAGE_WRAPPER_BLUR_IMPLEMENTATION
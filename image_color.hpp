@@ -0,0 +1,562 @@
+#ifndef STB_IMAGE_WRAPPER_COLOR_INCLUDE
+#define STB_IMAGE_WRAPPER_COLOR_INCLUDE
+
+#include "image.hpp"
+#include <algorithm>
+#include <math.h>
+
+
+// Planes of YCbCr image: 1 channel each, all of the same size.
+// Y is in [0, 255], Cb & Cr are shifted by 128 (as in JPEG), so ColorYCbCrA{y, cb, cr} is stored as {255*y, 255*cb + 128, 255*cr + 128}
+struct YCbCrPlanes {
+    ImageView y, cb, cr;
+};
+
+// Whole-image conversions, by default with current ColorYCbCrA::Kr & ColorYCbCrA::Kb.
+// src/dst must have 3 or 4 channels (alpha is ignored / left untouched).
+void convert_rgb_to_ycbcr(ConstImageView src, YCbCrPlanes out, const YCbCrSpace &space = YCbCrSpace::current(), ThreadPool &pool = ThreadPool::shared());
+void convert_ycbcr_to_rgb(const YCbCrPlanes &src, ImageView dst, const YCbCrSpace &space = YCbCrSpace::current(), ThreadPool &pool = ThreadPool::shared());
+
+// Planar (structure of arrays) float image for whole-frame color math: separate r, g, b & a planes
+// of width*height values (row by row), normalized to [0, 1]. Loops over the planes run in SIMD lanes:
+//      for (size_t i=0; i<buf.size(); i++) buf.r[i] *= exposure;
+struct ColorBuffer {
+    int width = 0, height = 0;
+    std::vector<float> r, g, b, a;
+
+    ColorBuffer() = default;
+    ColorBuffer(int width, int height);
+
+    // keeps capacity of planes, so the same buffer can be reused for frames of the same size
+    void resize(int width, int height);
+    size_t size() const { return (size_t)width*height; }
+
+    ColorRGBAf at(int x, int y) const {
+        size_t i = (size_t)y*width + x;
+        return ColorRGBAf(r[i], g[i], b[i], a[i]);
+    }
+    void set(int x, int y, const ColorRGBAf &c) {
+        size_t i = (size_t)y*width + x;
+        r[i] = c.r; g[i] = c.g; b[i] = c.b; a[i] = c.a;
+    }
+
+    // c = f(c) for every color (ColorRGBAf), rows in parallel
+    template<class F>
+    void transform(F &&f) {
+        parallel_for_bands(this->height, (size_t)this->width*4*sizeof(float), [&](int y_begin, int y_end) {
+            float *r = this->r.data(), *g = this->g.data(), *b = this->b.data(), *a = this->a.data();
+            size_t end = (size_t)y_end*this->width;
+            for (size_t i=(size_t)y_begin*this->width; i<end; i++) {
+                ColorRGBAf c = f(ColorRGBAf(r[i], g[i], b[i], a[i]));
+                r[i] = c.r; g[i] = c.g; b[i] = c.b; a[i] = c.a;
+            }
+        });
+    }
+};
+
+// Image (1 to 4 channels, any sample type) to normalized planes, out is resized to image size.
+// Gray goes to r, g & b, missing alpha is 1. Integers are mapped to [0, 1], floats are copied as they are.
+void to_normalized(ConstImageView src, ColorBuffer &out);
+ColorBuffer to_normalized(ConstImageView src);
+// Planes back to image of the same size: gray is the average of r, g & b, integers are clamped to [0, 1] & rounded.
+void from_normalized(const ColorBuffer &src, ImageView dst);
+
+// Whole-image sRGB transfer with lookup tables, src & dst of the same size & channels (1 to 4).
+// srgb_to_linear: 8-bit sRGB -> float (Image::F32) linear light; linear_to_srgb: the inverse, clamped to [0, 1].
+// Alpha (last of 2 or 4 channels) is not gamma encoded, it is only mapped between [0, 255] & [0, 1].
+void srgb_to_linear(ConstImageView src, ImageView dst);
+void linear_to_srgb(ConstImageView src, ImageView dst);
+
+#endif // STB_IMAGE_WRAPPER_COLOR_INCLUDE
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+#ifdef STB_IMAGE_WRAPPER_COLOR_IMPLEMENTATION
+
+#if !defined(STB_IMAGE_WRAPPER_NO_SIMD)
+    #if defined(__AVX2__)
+        #define STB_IMAGE_WRAPPER_AVX2
+        #include <immintrin.h>
+    #elif defined(__SSE2__) || defined(_M_X64)
+        #define STB_IMAGE_WRAPPER_SSE2
+        #include <emmintrin.h>
+    #endif
+#endif
+
+// Kernels of the bulk conversions run YCbCrFixed of the space (built once with the space):
+// with 16-bit lanes v<<7 times Q13 coefficients, _mm_mulhi_epi16 gives v*m with 4 fractional bits.
+// The scalar kernel does the same arithmetic, so a value converts the same anywhere in a row & with any SIMD.
+static void color_matrix_row_scalar(const uint8_t *const in[3], uint8_t *const out[3], int start, int n, const YCbCrFixed &cm) {
+    for (int k=0; k<3; k++) {
+        uint8_t *o = out[k];
+        for (int i=start; i<n; i++) {
+            // (v<<7)*m >> 16 as _mm_mulhi_epi16 does, rounded down
+            int v = cm.offset[k];
+            for (int j=0; j<3; j++) v += (int)(((int64_t)(in[j][i] << 7)*cm.m[k][j]) >> 16);
+            v >>= 4;
+            o[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+    }
+}
+
+#if defined(STB_IMAGE_WRAPPER_AVX2)
+static void color_matrix_row(const uint8_t *const in[3], uint8_t *const out[3], int n, const YCbCrFixed &cm) {
+    if (!cm.simd) {
+        color_matrix_row_scalar(in, out, 0, n, cm);
+        return;
+    }
+    __m256i m[3][3], offset[3];
+    for (int k=0; k<3; k++) {
+        for (int j=0; j<3; j++) m[k][j] = _mm256_set1_epi16((int16_t)cm.m[k][j]);
+        offset[k] = _mm256_set1_epi16((int16_t)cm.offset[k]);
+    }
+
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i+32 <= n; i+=32) {
+        // unpack & pack work inside 128-bit lanes, so the pixel order is restored by packus
+        __m256i v[3][2];
+        for (int j=0; j<3; j++) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i*)(in[j] + i));
+            v[j][0] = _mm256_slli_epi16(_mm256_unpacklo_epi8(bytes, zero), 7);
+            v[j][1] = _mm256_slli_epi16(_mm256_unpackhi_epi8(bytes, zero), 7);
+        }
+        for (int k=0; k<3; k++) {
+            __m256i res[2];
+            for (int h=0; h<2; h++) {
+                __m256i acc = offset[k];
+                acc = _mm256_add_epi16(acc, _mm256_mulhi_epi16(v[0][h], m[k][0]));
+                acc = _mm256_add_epi16(acc, _mm256_mulhi_epi16(v[1][h], m[k][1]));
+                acc = _mm256_add_epi16(acc, _mm256_mulhi_epi16(v[2][h], m[k][2]));
+                res[h] = _mm256_srai_epi16(acc, 4);
+            }
+            _mm256_storeu_si256((__m256i*)(out[k] + i), _mm256_packus_epi16(res[0], res[1]));
+        }
+    }
+    color_matrix_row_scalar(in, out, i, n, cm);
+}
+#elif defined(STB_IMAGE_WRAPPER_SSE2)
+static void color_matrix_row(const uint8_t *const in[3], uint8_t *const out[3], int n, const YCbCrFixed &cm) {
+    if (!cm.simd) {
+        color_matrix_row_scalar(in, out, 0, n, cm);
+        return;
+    }
+    __m128i m[3][3], offset[3];
+    for (int k=0; k<3; k++) {
+        for (int j=0; j<3; j++) m[k][j] = _mm_set1_epi16((int16_t)cm.m[k][j]);
+        offset[k] = _mm_set1_epi16((int16_t)cm.offset[k]);
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i+16 <= n; i+=16) {
+        __m128i v[3][2];
+        for (int j=0; j<3; j++) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(in[j] + i));
+            v[j][0] = _mm_slli_epi16(_mm_unpacklo_epi8(bytes, zero), 7);
+            v[j][1] = _mm_slli_epi16(_mm_unpackhi_epi8(bytes, zero), 7);
+        }
+        for (int k=0; k<3; k++) {
+            __m128i res[2];
+            for (int h=0; h<2; h++) {
+                __m128i acc = offset[k];
+                acc = _mm_add_epi16(acc, _mm_mulhi_epi16(v[0][h], m[k][0]));
+                acc = _mm_add_epi16(acc, _mm_mulhi_epi16(v[1][h], m[k][1]));
+                acc = _mm_add_epi16(acc, _mm_mulhi_epi16(v[2][h], m[k][2]));
+                res[h] = _mm_srai_epi16(acc, 4);
+            }
+            _mm_storeu_si128((__m128i*)(out[k] + i), _mm_packus_epi16(res[0], res[1]));
+        }
+    }
+    color_matrix_row_scalar(in, out, i, n, cm);
+}
+#else
+static void color_matrix_row(const uint8_t *const in[3], uint8_t *const out[3], int n, const YCbCrFixed &cm) {
+    color_matrix_row_scalar(in, out, 0, n, cm);
+}
+#endif
+
+template<int CH>
+static void deinterleave_rgb(const uint8_t *p, uint8_t *r, uint8_t *g, uint8_t *b, int n) {
+    for (int x=0; x<n; x++) {
+        r[x] = p[x*CH];
+        g[x] = p[x*CH + 1];
+        b[x] = p[x*CH + 2];
+    }
+}
+
+template<int CH>
+static void interleave_rgb(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint8_t *p, int n) {
+    int x = 0;
+    if (CH == 3) {
+        // one overlapping 4-byte store per pixel instead of three byte stores, the 4th byte is rewritten by next pixel
+        for (; x+1<n; x++) {
+            uint32_t v = (uint32_t)r[x] | ((uint32_t)g[x] << 8) | ((uint32_t)b[x] << 16) | ((uint32_t)r[x+1] << 24);
+            memcpy(p + x*3, &v, 4);
+        }
+    }
+    for (; x<n; x++) {
+        p[x*CH] = r[x];
+        p[x*CH + 1] = g[x];
+        p[x*CH + 2] = b[x];
+    }
+}
+
+ColorBuffer::ColorBuffer(int width, int height) {
+    this->resize(width, height);
+}
+
+void ColorBuffer::resize(int width, int height) {
+    assert(width >= 0 && height >= 0);
+    this->width = width;
+    this->height = height;
+    for (std::vector<float> *plane: {&this->r, &this->g, &this->b, &this->a}) {
+        plane->resize(this->size());
+    }
+}
+
+// normalized floats <-> bytes, clamped to [0, 1] & rounded like normalized_to_u8
+#if defined(STB_IMAGE_WRAPPER_AVX2)
+static void u8_to_normalized_row(const uint8_t *in, float *out, int n) {
+    const __m256 k = _mm256_set1_ps(1.0f/255);
+    int x = 0;
+    for (; x+8<=n; x+=8) {
+        __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + x)));
+        _mm256_storeu_ps(out + x, _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+    }
+    for (; x<n; x++) out[x] = in[x] * (1.0f/255);
+}
+
+static void normalized_to_u8_row(const float *in, uint8_t *out, int n) {
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1), scale = _mm256_set1_ps(255), half = _mm256_set1_ps(0.5f);
+    // packs work inside 128-bit lanes, the permutation restores the order of 4-byte groups
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int x = 0;
+    for (; x+32<=n; x+=32) {
+        __m256i v[4];
+        for (int i=0; i<4; i++) {
+            // max(v, 0) gives 0 for NaN
+            __m256 f = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + x + 8*i), zero), one);
+            v[i] = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(f, scale), half));
+        }
+        __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_permutevar8x32_epi32(bytes, order));
+    }
+    for (; x<n; x++) out[x] = normalized_to_u8(in[x]);
+}
+#elif defined(STB_IMAGE_WRAPPER_SSE2)
+static void u8_to_normalized_row(const uint8_t *in, float *out, int n) {
+    const __m128 k = _mm_set1_ps(1.0f/255);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x+16<=n; x+=16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + x));
+        __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps(out + x,      _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), k));
+        _mm_storeu_ps(out + x + 4,  _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), k));
+        _mm_storeu_ps(out + x + 8,  _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), k));
+        _mm_storeu_ps(out + x + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), k));
+    }
+    for (; x<n; x++) out[x] = in[x] * (1.0f/255);
+}
+
+static void normalized_to_u8_row(const float *in, uint8_t *out, int n) {
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1), scale = _mm_set1_ps(255), half = _mm_set1_ps(0.5f);
+    int x = 0;
+    for (; x+16<=n; x+=16) {
+        __m128i v[4];
+        for (int i=0; i<4; i++) {
+            // max(v, 0) gives 0 for NaN
+            __m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + x + 4*i), zero), one);
+            v[i] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), half));
+        }
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+        _mm_storeu_si128((__m128i*)(out + x), bytes);
+    }
+    for (; x<n; x++) out[x] = normalized_to_u8(in[x]);
+}
+#else
+static void u8_to_normalized_row(const uint8_t *in, float *out, int n) {
+    for (int x=0; x<n; x++) out[x] = in[x] * (1.0f/255);
+}
+
+static void normalized_to_u8_row(const float *in, uint8_t *out, int n) {
+    for (int x=0; x<n; x++) out[x] = normalized_to_u8(in[x]);
+}
+#endif
+
+// planes of one row from interleaved values of CH channels (gray, gray+alpha, rgb, rgba), scaled by k
+template<int CH, class InT>
+static void deinterleave_normalized(const InT *p, float *r, float *g, float *b, float *a, int n, float k) {
+    for (int x=0; x<n; x++) {
+        if (CH <= 2) {
+            r[x] = g[x] = b[x] = p[x*CH] * k;
+        } else {
+            r[x] = p[x*CH] * k;
+            g[x] = p[x*CH + 1] * k;
+            b[x] = p[x*CH + 2] * k;
+        }
+        a[x] = (CH == 2 || CH == 4) ? p[x*CH + CH - 1] * k : 1.0f;
+    }
+}
+
+template<int CH>
+static void to_normalized_row(const uint8_t *p, float *r, float *g, float *b, float *a, int n, 
+    Image::SampleType sample, std::vector<float> &tmp) 
+{
+    if (sample == Image::U8) {
+        // bytes are split into planes first, planes are converted with SIMD
+        tmp.resize(n);
+        uint8_t *r8 = (uint8_t*)tmp.data(), *g8 = r8 + n, *b8 = g8 + n, *a8 = b8 + n;
+        if (CH >= 3) {
+            deinterleave_rgb<CH>(p, r8, g8, b8, n);
+        } else {
+            for (int x=0; x<n; x++) r8[x] = p[x*CH];
+        }
+        u8_to_normalized_row(r8, r, n);
+        if (CH >= 3) {
+            u8_to_normalized_row(g8, g, n);
+            u8_to_normalized_row(b8, b, n);
+        } else {
+            memcpy(g, r, n*sizeof(float));
+            memcpy(b, r, n*sizeof(float));
+        }
+        if (CH == 2 || CH == 4) {
+            for (int x=0; x<n; x++) a8[x] = p[x*CH + CH - 1];
+            u8_to_normalized_row(a8, a, n);
+        } else {
+            std::fill(a, a + n, 1.0f);
+        }
+        return;
+    }
+    tmp.resize((size_t)n*CH);
+    convert_samples(ConstImageView(p, n, 1, CH, 0, sample), ImageView((uint8_t*)tmp.data(), n, 1, CH, 0, Image::F32));
+    deinterleave_normalized<CH>(tmp.data(), r, g, b, a, n, 1.0f);
+}
+
+template<int CH, class OutT, class F>
+static void interleave_normalized(const float *r, const float *g, const float *b, const float *a, OutT *p, int n, F convert) {
+    for (int x=0; x<n; x++) {
+        if (CH <= 2) {
+            p[x*CH] = convert((r[x] + g[x] + b[x]) * (1.0f/3));
+        } else {
+            p[x*CH] = convert(r[x]);
+            p[x*CH + 1] = convert(g[x]);
+            p[x*CH + 2] = convert(b[x]);
+        }
+        if (CH == 2 || CH == 4) p[x*CH + CH - 1] = convert(a[x]);
+    }
+}
+
+static void check_normalized_channels(int channels) {
+    if (channels < 1 || channels > 4) {
+        throw std::invalid_argument("Normalized conversion expects 1 to 4 channels, got " + std::to_string(channels));
+    }
+}
+
+void to_normalized(ConstImageView src, ColorBuffer &out) {
+    check_normalized_channels(src.channels);
+    out.resize(src.width, src.height);
+
+    parallel_for_bands(src.height, (size_t)src.width*src.channels*(src.sample + sizeof(float)), [&](int y_begin, int y_end) {
+        std::vector<float> tmp;
+        for (int y=y_begin; y<y_end; y++) {
+            const uint8_t *p = src.data + (size_t)y*src.stride;
+            size_t i = (size_t)y*src.width;
+            float *r = out.r.data() + i, *g = out.g.data() + i, *b = out.b.data() + i, *a = out.a.data() + i;
+            switch (src.channels) {
+            case 1: to_normalized_row<1>(p, r, g, b, a, src.width, src.sample, tmp); break;
+            case 2: to_normalized_row<2>(p, r, g, b, a, src.width, src.sample, tmp); break;
+            case 3: to_normalized_row<3>(p, r, g, b, a, src.width, src.sample, tmp); break;
+            case 4: to_normalized_row<4>(p, r, g, b, a, src.width, src.sample, tmp); break;
+            }
+        }
+    });
+}
+
+ColorBuffer to_normalized(ConstImageView src) {
+    ColorBuffer out;
+    to_normalized(src, out);
+    return out;
+}
+
+template<int CH>
+static void from_normalized_row(const float *r, const float *g, const float *b, const float *a, uint8_t *p, int n, 
+    Image::SampleType sample, std::vector<float> &tmp) 
+{
+    if (sample == Image::U8 && CH >= 3) {
+        // planar conversion vectorizes, interleaving of bytes is done by interleave_rgb
+        tmp.resize(n);
+        uint8_t *r8 = (uint8_t*)tmp.data(), *g8 = r8 + n, *b8 = g8 + n, *a8 = b8 + n;
+        normalized_to_u8_row(r, r8, n);
+        normalized_to_u8_row(g, g8, n);
+        normalized_to_u8_row(b, b8, n);
+        interleave_rgb<CH>(r8, g8, b8, p, n);
+        if (CH == 4) {
+            normalized_to_u8_row(a, a8, n);
+            for (int x=0; x<n; x++) p[x*4 + 3] = a8[x];
+        }
+        return;
+    }
+    if (sample == Image::U8) {
+        interleave_normalized<CH>(r, g, b, a, p, n, normalized_to_u8);
+        return;
+    }
+    tmp.resize((size_t)n*CH);
+    interleave_normalized<CH>(r, g, b, a, tmp.data(), n, [](float v) { return v; });
+    convert_samples(ConstImageView((const uint8_t*)tmp.data(), n, 1, CH, 0, Image::F32), ImageView(p, n, 1, CH, 0, sample));
+}
+
+void from_normalized(const ColorBuffer &src, ImageView dst) {
+    check_normalized_channels(dst.channels);
+    if (src.width != dst.width || src.height != dst.height) {
+        throw std::invalid_argument("Normalized conversion destination does not match buffer size");
+    }
+
+    parallel_for_bands(dst.height, (size_t)dst.width*dst.channels*(dst.sample + sizeof(float)), [&](int y_begin, int y_end) {
+        std::vector<float> tmp;
+        for (int y=y_begin; y<y_end; y++) {
+            size_t i = (size_t)y*src.width;
+            const float *r = src.r.data() + i, *g = src.g.data() + i, *b = src.b.data() + i, *a = src.a.data() + i;
+            uint8_t *p = dst.data + (size_t)y*dst.stride;
+            switch (dst.channels) {
+            case 1: from_normalized_row<1>(r, g, b, a, p, dst.width, dst.sample, tmp); break;
+            case 2: from_normalized_row<2>(r, g, b, a, p, dst.width, dst.sample, tmp); break;
+            case 3: from_normalized_row<3>(r, g, b, a, p, dst.width, dst.sample, tmp); break;
+            case 4: from_normalized_row<4>(r, g, b, a, p, dst.width, dst.sample, tmp); break;
+            }
+        }
+    });
+}
+
+static void check_transfer_images(ConstImageView srgb, ConstImageView linear) {
+    check_normalized_channels(srgb.channels);
+    if (srgb.width != linear.width || srgb.height != linear.height || srgb.channels != linear.channels) {
+        throw std::invalid_argument("sRGB conversion source does not match destination");
+    }
+    if (srgb.sample != Image::U8 || linear.sample != Image::F32) {
+        throw std::invalid_argument("sRGB conversion expects 8-bit sRGB & float linear images");
+    }
+}
+
+void srgb_to_linear(ConstImageView src, ImageView dst) {
+    check_transfer_images(src, dst);
+    int alpha = (src.channels == 2 || src.channels == 4) ? src.channels - 1 : -1;
+
+    parallel_for_bands(src.height, (size_t)src.width*src.channels*(1 + sizeof(float)), [&](int y_begin, int y_end) {
+        const float *decode = srgb_tables.decode;
+        for (int y=y_begin; y<y_end; y++) {
+            const uint8_t *in = src.data + (size_t)y*src.stride;
+            float *out = (float*)(dst.data + (size_t)y*dst.stride);
+            int n = src.width*src.channels;
+            for (int i=0; i<n; i++) out[i] = decode[in[i]];
+            if (alpha >= 0) {
+                for (int i=alpha; i<n; i+=src.channels) out[i] = in[i] * (1.0f/255);
+            }
+        }
+    });
+}
+
+void linear_to_srgb(ConstImageView src, ImageView dst) {
+    check_transfer_images(dst, src);
+    int alpha = (src.channels == 2 || src.channels == 4) ? src.channels - 1 : -1;
+
+    parallel_for_bands(src.height, (size_t)src.width*src.channels*(1 + sizeof(float)), [&](int y_begin, int y_end) {
+        for (int y=y_begin; y<y_end; y++) {
+            const float *in = (const float*)(src.data + (size_t)y*src.stride);
+            uint8_t *out = dst.data + (size_t)y*dst.stride;
+            int n = src.width*src.channels;
+            for (int i=0; i<n; i++) out[i] = linear_to_srgb(in[i]);
+            if (alpha >= 0) {
+                for (int i=alpha; i<n; i+=src.channels) out[i] = normalized_to_u8(in[i]);
+            }
+        }
+    });
+}
+
+void convert_rgb_to_ycbcr(ConstImageView src, YCbCrPlanes out, const YCbCrSpace &space, ThreadPool &pool) {
+    if (src.channels != 3 && src.channels != 4) {
+        throw std::invalid_argument("RGB to YCbCr conversion expects 3 or 4 channels, got " + std::to_string(src.channels));
+    }
+    if (src.sample != Image::U8) {
+        throw std::invalid_argument("RGB to YCbCr conversion expects 8-bit samples");
+    }
+    for (const ImageView *plane: {&out.y, &out.cb, &out.cr}) {
+        if (plane->width != src.width || plane->height != src.height || plane->channels != 1 || plane->sample != Image::U8) {
+            throw std::invalid_argument("YCbCr planes must be 1 channel 8-bit images of source size");
+        }
+    }
+
+    const YCbCrFixed &cm = space.to_ycbcr_fixed();
+    // every band has own temporary planar rows
+    parallel_for_bands(src.height, (size_t)src.width*(src.channels + 3), [&](int y_begin, int y_end) {
+        std::vector<uint8_t> rgb(3*(size_t)src.width);
+        uint8_t *r = rgb.data(), *g = r + src.width, *b = g + src.width;
+        const uint8_t *const in[3] = {r, g, b};
+
+        for (int y=y_begin; y<y_end; y++) {
+            const uint8_t *p = src.data + (size_t)y*src.stride;
+            if (src.channels == 3) deinterleave_rgb<3>(p, r, g, b, src.width);
+            else deinterleave_rgb<4>(p, r, g, b, src.width);
+
+            uint8_t *const planes[3] = {
+                out.y.data + (size_t)y*out.y.stride,
+                out.cb.data + (size_t)y*out.cb.stride,
+                out.cr.data + (size_t)y*out.cr.stride,
+            };
+            color_matrix_row(in, planes, src.width, cm);
+        }
+    }, pool);
+}
+
+void convert_ycbcr_to_rgb(const YCbCrPlanes &src, ImageView dst, const YCbCrSpace &space, ThreadPool &pool) {
+    if (dst.channels != 3 && dst.channels != 4) {
+        throw std::invalid_argument("YCbCr to RGB conversion expects 3 or 4 channels, got " + std::to_string(dst.channels));
+    }
+    if (dst.sample != Image::U8) {
+        throw std::invalid_argument("YCbCr to RGB conversion expects 8-bit samples");
+    }
+    for (const ImageView *plane: {&src.y, &src.cb, &src.cr}) {
+        if (plane->width != dst.width || plane->height != dst.height || plane->channels != 1 || plane->sample != Image::U8) {
+            throw std::invalid_argument("YCbCr planes must be 1 channel 8-bit images of destination size");
+        }
+    }
+
+    const YCbCrFixed &cm = space.to_rgb_fixed();
+    // every band has own temporary planar rows
+    parallel_for_bands(dst.height, (size_t)dst.width*(dst.channels + 3), [&](int y_begin, int y_end) {
+        std::vector<uint8_t> rgb(3*(size_t)dst.width);
+        uint8_t *r = rgb.data(), *g = r + dst.width, *b = g + dst.width;
+        uint8_t *const out[3] = {r, g, b};
+
+        for (int y=y_begin; y<y_end; y++) {
+            const uint8_t *const planes[3] = {
+                src.y.data + (size_t)y*src.y.stride,
+                src.cb.data + (size_t)y*src.cb.stride,
+                src.cr.data + (size_t)y*src.cr.stride,
+            };
+            color_matrix_row(planes, out, dst.width, cm);
+
+            uint8_t *p = dst.data + (size_t)y*dst.stride;
+            if (dst.channels == 3) interleave_rgb<3>(r, g, b, p, dst.width);
+            else interleave_rgb<4>(r, g, b, p, dst.width);
+        }
+    }, pool);
+}
+
+#endif // STB_IMAGE_WRAPPER_COLOR_IMPLEMENTATION
@@ -3,16 +3,74 @@
 
 #include "image.hpp"
 #include <math.h>
+#include <limits>
 
+// Rectangle of pixels [x0, x1) x [y0, y1) drawing is limited to
+struct ClipRect {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    ClipRect() = default;
+    ClipRect(int x0, int y0, int x1, int y1): x0(x0), y0(y0), x1(x1), y1(y1) {}
+    // the whole view
+    explicit ClipRect(ConstImageView img): x0(0), y0(0), x1(img.width), y1(img.height) {}
+    // clips nothing
+    static ClipRect unbounded();
+
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+    bool contains(int x, int y) const { return x >= x0 && x < x1 && y >= y0 && y < y1; }
+    ClipRect intersection(const ClipRect &other) const;
+};
+
+
+// Pixel nearest to (x, y) is set, coordinates out of the image are clamped to its border
+template<class ColorT>
+inline void plot(ImageView img, float x, float y, ColorT clr);
 
 template<class ColorT>
-inline void plot(Image &img, float x, float y, ColorT clr);
+inline void plot_add(ImageView img, float x, float y, ColorT clr, float k);
 
+// plot_add with k = alpha/255, integer only for PixelGray, PixelRGB & PixelRGBA
 template<class ColorT>
-inline void plot_add(Image &img, float x, float y, ColorT clr, float k);
+inline void plot_blend(ImageView img, float x, float y, ColorT clr, uint8_t alpha);
 
+// Clipped drawing: pixels out of clip (& out of the image) are skipped instead of clamped
+template<class ColorT>
+inline void plot(ImageView img, const ClipRect &clip, float x, float y, ColorT clr);
 template<class ColorT>
-void draw_line(Image &img, 
+inline void plot_add(ImageView img, const ClipRect &clip, float x, float y, ColorT clr, float k);
+template<class ColorT>
+inline void plot_blend(ImageView img, const ClipRect &clip, float x, float y, ColorT clr, uint8_t alpha);
+
+// dst = dst*(1-k) + src*k with k = alpha/255 (8.8 fixed point for PixelGray, PixelRGB & PixelRGBA,
+// other types go through their operator* & operator+, images go to the whole-image overload)
+template<class ColorT> requires (!std::is_base_of_v<Image, ColorT>)
+inline void blend(ColorT &dst, const ColorT &src, uint8_t alpha);
+
+// k in [0, 1] to alpha in [0, 255]
+inline uint8_t blend_alpha(float k);
+
+// Row kernels (AVX2/SSE2 depending on compiler flags, scalar otherwise) blending every byte as blend_u8
+void blend_row(uint8_t *dst, const uint8_t *src, int bytes, uint8_t alpha);
+// blends count pixels of dst with one color of `channels` (1..4) bytes
+void blend_fill_row(uint8_t *dst, const uint8_t *color, int channels, int count, uint8_t alpha);
+// sets count pixels of dst to one color of `channels` (1..4) bytes, by memset or doubling memcpy
+void fill_row(uint8_t *dst, const uint8_t *color, int channels, int count);
+// blends src over dst (same size, channels, 8-bit), rows in parallel
+void blend(ImageView dst, ConstImageView src, uint8_t alpha);
+
+// Blending in linear light: sRGB values are decoded, mixed & encoded back with lookup tables,
+// so a half-transparent white over black is 188 instead of 128. Alpha channel is blended as is.
+// PixelGray, PixelRGB & PixelRGBA only, other types are blended as by blend.
+template<class ColorT> requires (!std::is_base_of_v<Image, ColorT>)
+inline void blend_linear(ColorT &dst, const ColorT &src, uint8_t alpha);
+template<class ColorT>
+inline void plot_blend_linear(ImageView img, float x, float y, ColorT clr, uint8_t alpha);
+// count pixels of `channels` (1..4, alpha is the last of 2 or 4)
+void blend_linear_row(uint8_t *dst, const uint8_t *src, int channels, int count, uint8_t alpha);
+void blend_linear(ImageView dst, ConstImageView src, uint8_t alpha);
+
+template<class ColorT>
+void draw_line(ImageView img, 
     float x0, float y0,
     float x1, float y1,
     ColorT clr,
@@ -20,7 +78,7 @@ void draw_line(Image &img,
 );
 
 template<class ColorT>
-void add_line_edge(Image &img, 
+void add_line_edge(ImageView img, 
     float x0, float y0,
     float x1, float y1,
     ColorT clr,
@@ -29,7 +87,7 @@ void add_line_edge(Image &img,
 );
 
 template<class ColorT>
-void add_line_noedge(Image &img, 
+void add_line_noedge(ImageView img, 
     float x0, float y0,
     float x1, float y1,
     ColorT clr,
@@ -37,6 +95,224 @@ void add_line_noedge(Image &img,
     float k = 0.5
 );
 
+// Clipped lines: the segment is cut to the clip once, pixels out of clip are never visited
+template<class ColorT>
+void draw_line(ImageView img, const ClipRect &clip, float x0, float y0, float x1, float y1, ColorT clr, float thickness);
+template<class ColorT>
+void add_line_edge(ImageView img, const ClipRect &clip, float x0, float y0, float x1, float y1, ColorT clr, float thickness, float k = 0.5);
+template<class ColorT>
+void add_line_noedge(ImageView img, const ClipRect &clip, float x0, float y0, float x1, float y1, ColorT clr, float thickness, float k = 0.5);
+
+// Coordinates of shapes are those of plot: pixel (x, y) is centered at integer (x, y)
+struct PointF {
+    float x = 0, y = 0;
+};
+
+// Contours of straight segments, every contour is closed (its last point connects to the first)
+struct Path {
+    std::vector<PointF> points;
+    // end (exclusive) of every contour in points
+    std::vector<size_t> ends;
+
+    // starts a new contour
+    void move_to(float x, float y);
+    void line_to(float x, float y);
+    // ends the current contour, the next line_to starts a new one from the last point
+    void close();
+    void add_polygon(std::span<const PointF> polygon);
+    void clear();
+};
+
+typedef enum {
+    FILL_NONZERO = 0,
+    FILL_EVENODD = 1,
+} FillRule;
+
+// Scanline rasterizer with exact area coverage anti-aliasing.
+// Edges are clipped to the clip box when added (parts left or right of it become vertical edges on its sides).
+// Rows are swept from the top with an active edge table, each row accumulates coverage only in the cells
+// edges cross, and coverage between cells is constant - so insides of shapes come out as whole spans.
+// Keeps its buffers between shapes, reuse one per thread (see local()).
+class Rasterizer {
+    struct Edge {
+        float x0, y0, x1, y1; // y0 < y1
+        float dxdy, dydx;
+        int dir; // +1 if the edge went down, -1 if up
+    };
+    struct Cell {
+        int x;
+        float cover; // sum of signed heights of edge parts in the pixel
+        float area;  // coverage of the pixel itself: height times the part of the pixel right of the edge
+    };
+    std::vector<Edge> edges;
+    std::vector<int> active;
+    std::vector<Cell> cells; // cells of the current row, cell_count of them are used
+    size_t cell_count = 0;
+    int clip_x0 = 0, clip_y0 = 0, clip_x1 = 0, clip_y1 = 0;
+    float min_y = 0, max_y = 0;
+
+    void add_edge(float x0, float y0, float x1, float y1, int dir);
+    void add_cells(const Edge &edge, float y0, float y1);
+    // triangles between offsets n0 & n1 on both sides of joint p
+    void add_bevel(PointF p, PointF n0, PointF n1);
+    float coverage(float winding) const;
+    public:
+    FillRule rule = FILL_NONZERO;
+
+    // removes all edges, the clip box is [x0, x1) x [y0, y1) in pixels
+    void reset(int x0, int y0, int x1, int y1);
+    void add_line(PointF a, PointF b);
+    // closed polygon
+    void add_polygon(std::span<const PointF> polygon);
+    void add_path(const Path &path);
+    // outline of polyline of given thickness: a rectangle per segment & bevel joins, all of one orientation,
+    // so FILL_NONZERO fills their union (overlaps are not covered twice)
+    void add_stroke(std::span<const PointF> polyline, float thickness, bool closed = false);
+
+    // Calls span(y, x_begin, x_end, coverage) for runs of pixels of equal coverage in (0, 1], row by row from the top
+    template<class F>
+    void sweep(F &&span);
+
+    // rasterizer of the calling thread used by fill functions, so they do not allocate per shape
+    static Rasterizer& local();
+};
+
+// Sets (alpha 255) or blends pixels [x0, x1) of row y with clr, pixels outside the image are skipped.
+// 8-bit pixel structures are blended by blend_fill_row, others by blend.
+template<class ColorT>
+void fill_span(ImageView img, int y, int x0, int x1, ColorT clr, uint8_t alpha);
+
+// Anti-aliased filled shapes: pixels get k*coverage of clr as in plot_add
+template<class ColorT>
+void fill_polygon(ImageView img, std::span<const PointF> polygon, ColorT clr, float k = 1, FillRule rule = FILL_NONZERO);
+
+template<class ColorT>
+void fill_path(ImageView img, const Path &path, ColorT clr, float k = 1, FillRule rule = FILL_NONZERO);
+
+// Polyline of given thickness with butt ends & bevel joins, filled by Rasterizer in one pass.
+// closed connects the last point to the first.
+template<class ColorT>
+void stroke_polyline(ImageView img, std::span<const PointF> polyline, ColorT clr, float thickness = 1, float k = 1, bool closed = false);
+
+// Shapes limited to clip (edges are clipped before rasterization, so it costs nothing per pixel)
+template<class ColorT>
+void fill_polygon(ImageView img, const ClipRect &clip, std::span<const PointF> polygon, ColorT clr, float k = 1, FillRule rule = FILL_NONZERO);
+template<class ColorT>
+void fill_path(ImageView img, const ClipRect &clip, const Path &path, ColorT clr, float k = 1, FillRule rule = FILL_NONZERO);
+template<class ColorT>
+void stroke_polyline(ImageView img, const ClipRect &clip, std::span<const PointF> polyline, ColorT clr, float thickness = 1, float k = 1, bool closed = false);
+
+// Liang-Barsky: cuts segment to the box [x_min, x_max] x [y_min, y_max], false if nothing is left
+bool clip_segment(float &x0, float &y0, float &x1, float &y1, float x_min, float y_min, float x_max, float y_max);
+
+// Anti-aliased line of given thickness with butt ends, pixels get k*coverage of clr as in plot_add.
+// The segment is clipped to the image once, then drawn row by row: edge pixels are blended one by one,
+// fully covered pixels between them are filled as a span.
+template<class ColorT>
+void stroke_line(ImageView img, float x0, float y0, float x1, float y1, ColorT clr, float thickness = 1, float k = 1);
+// the segment is clipped to clip instead
+template<class ColorT>
+void stroke_line(ImageView img, const ClipRect &clip, float x0, float y0, float x1, float y1, ColorT clr, float thickness = 1, float k = 1);
+
+// Anti-aliased ellipses with axes along x & y, pixels get k*coverage of clr as in plot_add.
+// Drawn row by row: coverage (from the distance of pixel centers to the edge, exact for circles)
+// is computed for edge pixels only, fully covered pixels between them are filled as spans.
+template<class ColorT>
+void fill_ellipse(ImageView img, float cx, float cy, float rx, float ry, ColorT clr, float k = 1);
+// ring between the ellipses of radii rx -+ thickness/2 & ry -+ thickness/2
+template<class ColorT>
+void stroke_ellipse(ImageView img, float cx, float cy, float rx, float ry, ColorT clr, float thickness = 1, float k = 1);
+template<class ColorT>
+void fill_circle(ImageView img, float cx, float cy, float radius, ColorT clr, float k = 1);
+template<class ColorT>
+void stroke_circle(ImageView img, float cx, float cy, float radius, ColorT clr, float thickness = 1, float k = 1);
+
+// Arcs from angle start to end in radians, from x towards y (clockwise on the image, y goes down).
+// Angles of ellipses are parametric: the point at angle a is (cx + rx*cos(a), cy + ry*sin(a)).
+// Ends are cut along lines from the center, fill_arc fills the sector between the arc & the center (pie slice).
+template<class ColorT>
+void stroke_arc(ImageView img, float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float thickness = 1, float k = 1);
+template<class ColorT>
+void fill_arc(ImageView img, float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float k = 1);
+
+// the same limited to clip
+template<class ColorT>
+void fill_ellipse(ImageView img, const ClipRect &clip, float cx, float cy, float rx, float ry, ColorT clr, float k = 1);
+template<class ColorT>
+void stroke_ellipse(ImageView img, const ClipRect &clip, float cx, float cy, float rx, float ry, ColorT clr, float thickness = 1, float k = 1);
+template<class ColorT>
+void fill_circle(ImageView img, const ClipRect &clip, float cx, float cy, float radius, ColorT clr, float k = 1);
+template<class ColorT>
+void stroke_circle(ImageView img, const ClipRect &clip, float cx, float cy, float radius, ColorT clr, float thickness = 1, float k = 1);
+template<class ColorT>
+void stroke_arc(ImageView img, const ClipRect &clip, float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float thickness = 1, float k = 1);
+template<class ColorT>
+void fill_arc(ImageView img, const ClipRect &clip, float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float k = 1);
+
+// Canvas is drawn in square tiles of CANVAS_TILE_SIZE pixels (256 RGB rows of a tile are 192 KB, they stay in cache)
+static const int CANVAS_TILE_SIZE = 256;
+
+// Draw list: records shapes, then draws them all at once.
+// draw() bins shapes into tiles by their bounding boxes and draws tiles in parallel, every tile draws
+// its shapes in order of submission clipped to itself - the image is the same as if shapes were drawn one by one
+// (up to 1 level of rounding of filled shapes at tile borders).
+// Shapes are limited to the intersection of clip rectangles pushed when they were recorded.
+template<class ColorT>
+class Canvas {
+    typedef enum {
+        SHAPE_LINE = 0,
+        SHAPE_POLYLINE = 1,
+        SHAPE_CLOSED_POLYLINE = 2,
+        SHAPE_POLYGON = 3,
+        SHAPE_ELLIPSE = 4,
+        SHAPE_FILLED_ELLIPSE = 5,
+        SHAPE_ARC = 6,
+        SHAPE_FILLED_ARC = 7,
+    } Shape;
+    struct Command {
+        Shape shape;
+        ColorT color;
+        float thickness, k;
+        FillRule rule;
+        uint32_t first, count; // range of points, ellipses & arcs have {center, radii, {start, end}}
+        float x0, y0, x1, y1;  // bounding box of touched pixels
+        ClipRect clip;
+    };
+    std::vector<Command> commands;
+    std::vector<PointF> points;
+    // intersections of pushed rectangles, the last one is current
+    std::vector<ClipRect> clips;
+
+    void add(Shape shape, std::span<const PointF> shape_points, ColorT clr, float thickness, float k, FillRule rule);
+    public:
+    // same as functions of the same names
+    void stroke_line(float x0, float y0, float x1, float y1, ColorT clr, float thickness = 1, float k = 1);
+    void stroke_polyline(std::span<const PointF> polyline, ColorT clr, float thickness = 1, float k = 1, bool closed = false);
+    void fill_polygon(std::span<const PointF> polygon, ColorT clr, float k = 1, FillRule rule = FILL_NONZERO);
+    void fill_ellipse(float cx, float cy, float rx, float ry, ColorT clr, float k = 1);
+    void stroke_ellipse(float cx, float cy, float rx, float ry, ColorT clr, float thickness = 1, float k = 1);
+    void fill_circle(float cx, float cy, float radius, ColorT clr, float k = 1);
+    void stroke_circle(float cx, float cy, float radius, ColorT clr, float thickness = 1, float k = 1);
+    void stroke_arc(float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float thickness = 1, float k = 1);
+    void fill_arc(float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float k = 1);
+    // rectangles are recorded as polygons
+    void fill_rect(float x0, float y0, float x1, float y1, ColorT clr, float k = 1);
+    void stroke_rect(float x0, float y0, float x1, float y1, ColorT clr, float thickness = 1, float k = 1);
+
+    // shapes recorded until pop_clip() are limited to rect (and to rectangles pushed before)
+    void push_clip(const ClipRect &rect);
+    // throws std::logic_error if there is no rectangle to pop
+    void pop_clip();
+
+    // number of recorded shapes
+    size_t size() const;
+    // removes shapes & clip rectangles
+    void clear();
+
+    // draws recorded shapes on img, which may be of any size (shapes are not clipped beforehand)
+    void draw(ImageView img, ThreadPool &pool = ThreadPool::shared()) const;
+};
+
 #endif // STB_IMAGE_WRAPPER_EDIT_INCLUDE
 
 
@@ -63,7 +339,8 @@ void add_line_noedge(Image &img,
     temp = xold; xold = xnew; xnew = temp;  \
 }
 
-#define ipart(x) ((float)((int)(x)))
+// truncation without a cast to int, which overflows for far end points
+#define ipart(x) ((float)trunc(x))
 
 #define round(x) (float)( ipart(x + 0.5) )
 
@@ -71,9 +348,66 @@ void add_line_noedge(Image &img,
 
 #define rfpart(x) (1 - fpart(x))
 
+#if !defined(STB_IMAGE_WRAPPER_NO_SIMD)
+    #if defined(__AVX2__)
+        #define STB_IMAGE_WRAPPER_AVX2
+        #include <immintrin.h>
+    #elif defined(__SSE2__) || defined(_M_X64)
+        #define STB_IMAGE_WRAPPER_SSE2
+        #include <emmintrin.h>
+    #endif
+#endif
+
+inline uint8_t blend_alpha(float k) {
+    return k <= 0 ? 0 : k >= 1 ? 255 : (uint8_t)(k*255 + 0.5f);
+}
+
+// floor without a libm call (SSE2 has no rounding instruction)
+static inline int raster_floor(float v) {
+    int i = (int)v;
+    return i - (v < i);
+}
+
+ClipRect ClipRect::unbounded() {
+    return ClipRect(std::numeric_limits<int>::min(), std::numeric_limits<int>::min(), std::numeric_limits<int>::max(), std::numeric_limits<int>::max());
+}
+
+ClipRect ClipRect::intersection(const ClipRect &other) const {
+    return ClipRect(std::max(this->x0, other.x0), std::max(this->y0, other.y0), std::min(this->x1, other.x1), std::min(this->y1, other.y1));
+}
+
+template<class ColorT> requires (!std::is_base_of_v<Image, ColorT>)
+inline void blend(ColorT &dst, const ColorT &src, uint8_t alpha) {
+    if constexpr (requires { dst.blended(src, alpha); }) {
+        dst = dst.blended(src, alpha);
+    } else {
+        float k = alpha / 255.0f;
+        dst = (src*k + dst*(1-k));
+    }
+}
+
+inline uint8_t blend_linear_u8(uint8_t dst, uint8_t src, float k) {
+    float d = srgb_to_linear(dst);
+    return linear_to_srgb(d + (srgb_to_linear(src) - d)*k);
+}
+
+template<class ColorT> requires (!std::is_base_of_v<Image, ColorT>)
+inline void blend_linear(ColorT &dst, const ColorT &src, uint8_t alpha) {
+    float k = alpha / 255.0f;
+    if constexpr (std::is_same_v<ColorT, PixelGray>) {
+        dst.value = blend_linear_u8(dst.value, src.value, k);
+    } else if constexpr (std::is_same_v<ColorT, PixelRGB> || std::is_same_v<ColorT, PixelRGBA>) {
+        dst.r = blend_linear_u8(dst.r, src.r, k);
+        dst.g = blend_linear_u8(dst.g, src.g, k);
+        dst.b = blend_linear_u8(dst.b, src.b, k);
+        if constexpr (std::is_same_v<ColorT, PixelRGBA>) dst.a = blend_u8(dst.a, src.a, alpha);
+    } else {
+        blend(dst, src, alpha);
+    }
+}
 
 template<class ColorT>
-inline void plot(Image &img, float x, float y, ColorT clr) {
+inline void plot(ImageView img, float x, float y, ColorT clr) {
     int ix = (int)round(x);
     if (ix<0) ix = 0;
     else if (ix >= img.width) ix = img.width-1;
@@ -87,7 +421,7 @@ inline void plot(Image &img, float x, float y, ColorT clr) {
 }
 
 template<class ColorT>
-inline void plot_add(Image &img, float x, float y, ColorT clr, float k) {
+inline void plot_add(ImageView img, float x, float y, ColorT clr, float k) {
     int ix = (int)round(x);
     if (ix<0) ix = 0;
     else if (ix >= img.width) ix = img.width-1;
@@ -96,28 +430,236 @@ inline void plot_add(Image &img, float x, float y, ColorT clr, float k) {
     if (iy<0) iy = 0;
     else if (iy >= img.height) iy = img.height-1;
     
-    ColorT *current = (ColorT*)(img.at(ix, iy));
-    *current = (clr*k + (*current)*(1-k));
+    blend(*(ColorT*)img.at_unchecked(ix, iy), clr, blend_alpha(k));
 }
 
 template<class ColorT>
-void draw_line(Image &img, 
+inline void plot_blend(ImageView img, float x, float y, ColorT clr, uint8_t alpha) {
+    int ix = (int)round(x);
+    if (ix<0) ix = 0;
+    else if (ix >= img.width) ix = img.width-1;
+    
+    int iy = (int)round(y);
+    if (iy<0) iy = 0;
+    else if (iy >= img.height) iy = img.height-1;
+    
+    blend(*(ColorT*)img.at_unchecked(ix, iy), clr, alpha);
+}
+
+template<class ColorT>
+inline void plot_blend_linear(ImageView img, float x, float y, ColorT clr, uint8_t alpha) {
+    int ix = (int)round(x);
+    if (ix<0) ix = 0;
+    else if (ix >= img.width) ix = img.width-1;
+    
+    int iy = (int)round(y);
+    if (iy<0) iy = 0;
+    else if (iy >= img.height) iy = img.height-1;
+    
+    blend_linear(*(ColorT*)img.at_unchecked(ix, iy), clr, alpha);
+}
+
+// pixel nearest to (x, y), false if it is out of clip or of the image
+inline bool clip_pixel(ImageView img, const ClipRect &clip, float x, float y, int &ix, int &iy) {
+    // far & NaN coordinates are rejected before the conversion to int
+    if (!(x > -1 && y > -1 && x < img.width && y < img.height)) return false;
+    ix = raster_floor(x + 0.5f);
+    iy = raster_floor(y + 0.5f);
+    return clip.contains(ix, iy) && ix < img.width && iy < img.height;
+}
+
+template<class ColorT>
+inline void plot(ImageView img, const ClipRect &clip, float x, float y, ColorT clr) {
+    int ix, iy;
+    if (clip_pixel(img, clip, x, y, ix, iy)) *(ColorT*)img.at_unchecked(ix, iy) = clr;
+}
+
+template<class ColorT>
+inline void plot_add(ImageView img, const ClipRect &clip, float x, float y, ColorT clr, float k) {
+    int ix, iy;
+    if (clip_pixel(img, clip, x, y, ix, iy)) blend(*(ColorT*)img.at_unchecked(ix, iy), clr, blend_alpha(k));
+}
+
+template<class ColorT>
+inline void plot_blend(ImageView img, const ClipRect &clip, float x, float y, ColorT clr, uint8_t alpha) {
+    int ix, iy;
+    if (clip_pixel(img, clip, x, y, ix, iy)) blend(*(ColorT*)img.at_unchecked(ix, iy), clr, alpha);
+}
+
+#if defined(STB_IMAGE_WRAPPER_AVX2)
+
+void blend_row(uint8_t *dst, const uint8_t *src, int bytes, uint8_t alpha) {
+    const __m256i a = _mm256_set1_epi16(alpha), ia = _mm256_set1_epi16(255 - alpha);
+    const __m256i half = _mm256_set1_epi16(128), zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i+32 <= bytes; i+=32) {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        // x = s*a + d*(255-a) + 128 fits into 16 bits, x/255 = (x + (x >> 8)) >> 8
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), a), 
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia)), half);
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), a), 
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia)), half);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+        // unpack & pack work inside 128-bit lanes, so the byte order is restored
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    for (; i<bytes; i++) dst[i] = blend_u8(dst[i], src[i], alpha);
+}
+
+#elif defined(STB_IMAGE_WRAPPER_SSE2)
+
+void blend_row(uint8_t *dst, const uint8_t *src, int bytes, uint8_t alpha) {
+    const __m128i a = _mm_set1_epi16(alpha), ia = _mm_set1_epi16(255 - alpha);
+    const __m128i half = _mm_set1_epi16(128), zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i+16 <= bytes; i+=16) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        // x = s*a + d*(255-a) + 128 fits into 16 bits, x/255 = (x + (x >> 8)) >> 8
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), a), 
+            _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia)), half);
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), a), 
+            _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia)), half);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    for (; i<bytes; i++) dst[i] = blend_u8(dst[i], src[i], alpha);
+}
+
+#else
+
+void blend_row(uint8_t *dst, const uint8_t *src, int bytes, uint8_t alpha) {
+    for (int i=0; i<bytes; i++) dst[i] = blend_u8(dst[i], src[i], alpha);
+}
+
+#endif
+
+void blend_fill_row(uint8_t *dst, const uint8_t *color, int channels, int count, uint8_t alpha) {
+    assert(channels >= 1 && channels <= 4);
+
+    // 96 bytes is a multiple of 1..4 channels and of SIMD width, so the pattern can be blended as a row
+    const int PATTERN_BYTES = 96;
+    uint8_t pattern[PATTERN_BYTES];
+    for (int i=0; i<PATTERN_BYTES; i+=channels) memcpy(pattern + i, color, channels);
+
+    int bytes = count*channels;
+    for (int i=0; i<bytes; i+=PATTERN_BYTES) {
+        blend_row(dst + i, pattern, std::min(PATTERN_BYTES, bytes - i), alpha);
+    }
+}
+
+void fill_row(uint8_t *dst, const uint8_t *color, int channels, int count) {
+    assert(channels >= 1 && channels <= 4);
+    if (count <= 0) return;
+
+    int bytes = count*channels;
+    bool same_bytes = true;
+    for (int c=1; c<channels; c++) same_bytes &= color[c] == color[0];
+    if (same_bytes) {
+        memset(dst, color[0], bytes);
+        return;
+    }
+    // every copy doubles the filled part
+    memcpy(dst, color, channels);
+    for (int filled=channels; filled<bytes; filled*=2) {
+        memcpy(dst + filled, dst, std::min(filled, bytes - filled));
+    }
+}
+
+void blend(ImageView dst, ConstImageView src, uint8_t alpha) {
+    if (dst.width != src.width || dst.height != src.height || dst.channels != src.channels) {
+        throw std::invalid_argument("Blend source does not match destination");
+    }
+    if (dst.sample != Image::U8 || src.sample != Image::U8) {
+        throw std::invalid_argument("Blend expects 8-bit samples");
+    }
+    parallel_for_rows(dst, [&](int y) {
+        blend_row(dst.data + (size_t)y*dst.stride, src.data + (size_t)y*src.stride, dst.width*dst.channels, alpha);
+    });
+}
+
+void blend_linear_row(uint8_t *dst, const uint8_t *src, int channels, int count, uint8_t alpha) {
+    assert(channels >= 1 && channels <= 4);
+    if (alpha == 0) return;
+
+    float k = alpha / 255.0f;
+    int color_channels = (channels == 2 || channels == 4) ? channels - 1 : channels;
+    for (int x=0; x<count; x++, dst+=channels, src+=channels) {
+        for (int c=0; c<color_channels; c++) dst[c] = blend_linear_u8(dst[c], src[c], k);
+        if (color_channels != channels) dst[color_channels] = blend_u8(dst[color_channels], src[color_channels], alpha);
+    }
+}
+
+void blend_linear(ImageView dst, ConstImageView src, uint8_t alpha) {
+    if (dst.width != src.width || dst.height != src.height || dst.channels != src.channels) {
+        throw std::invalid_argument("Blend source does not match destination");
+    }
+    if (dst.sample != Image::U8 || src.sample != Image::U8) {
+        throw std::invalid_argument("Blend expects 8-bit samples");
+    }
+    parallel_for_rows(dst, [&](int y) {
+        blend_linear_row(dst.data + (size_t)y*dst.stride, src.data + (size_t)y*src.stride, dst.channels, dst.width, alpha);
+    });
+}
+
+// One column of a thick line: the top edge pixel in row y, rows y + i for 1 <= i < w & the bottom edge pixel
+// in row y + ipart(w). Only rows in [row0, row1) are visited, steep lines swap x & y back.
+template<bool steep, class ColorT, class Pixel>
+inline void line_column_pixels(float x, float y, float w, ColorT top, ColorT clr, ColorT bottom, float row0, float row1, Pixel &pixel) {
+    auto put = [&](float row, ColorT c) {
+        if constexpr (steep) pixel(row, x, c);
+        else pixel(x, row, c);
+    };
+    if (y >= row0 && y < row1) put(y, top);
+    // (bounds stay in float, rows far from the clip would overflow int)
+    int i_begin = (int)std::min(std::max(row0 - y, 1.0f), ceilf(w));
+    float i_end = std::min(w, row1 - y);
+    for (int i=i_begin; i<i_end; i++) {
+        put(y+i, clr);
+    }
+    float y_bottom = y+ipart(w);
+    if (y_bottom >= row0 && y_bottom < row1) put(y_bottom, bottom);
+}
+
+// Line algorithms call pixel(x, y, color) for every pixel instead of plotting it,
+// so clamped & clipped drawing share them. Only the part of the segment between from & to is drawn
+// (the segment itself, or what is left of it after clipping), with the same pixels as of the whole line.
+// Columns & rows out of clip are skipped without calling pixel.
+template<class ColorT, class Pixel>
+void draw_line_pixels(
     float x0, float y0,
     float x1, float y1,
     ColorT clr,
-    float thickness
+    float thickness,
+    PointF from, PointF to,
+    const ClipRect &clip,
+    Pixel &&pixel
 ) {
     bool steep = abs(y1-y0) > abs(x1 - x0); 
     
     if (steep) {
         swap(x0, y0);
         swap(x1, y1);
+        swap(from.x, from.y);
+        swap(to.x, to.y);
     }
     
     if (x0 > x1) {
         swap(x0, x1);
         swap(y0, y1);
     }
+    // columns of the part to draw, ends are drawn only if they are not cut off
+    float range_x0 = std::min(from.x, to.x), range_x1 = std::max(from.x, to.x);
+    // columns & rows of the clip, along the line & across it
+    float along0 = steep ? clip.y0 : clip.x0, along1 = steep ? clip.y1 : clip.x1;
+    float across0 = steep ? clip.x0 : clip.y0, across1 = steep ? clip.x1 : clip.y1;
     
     float dx = x1 - x0;
     float dy = y1 - y0;
@@ -127,96 +669,81 @@ void draw_line(Image &img,
     else            gradient = dy/dx;
     
     float w = thickness * sqrt(1 + (gradient * gradient));
+    // row of the line at column x, from the end points in double & the same for every column however the walk is clipped
+    // (ends may be far out of the clip, float steps from them would drift)
+    double slope = dx == 0 ? 1 : ((double)y1 - y0)/((double)x1 - x0);
+    float offset = (w-1)/2;
+    auto row_at = [&](int x) { return (float)(y0 + offset + slope*(x - (double)x0)); };
     
     float xend = round(x0);
     float yend = y0 + (w-1)/2 + gradient*(xend - x0);
     float xgap = rfpart(x0 + 0.5);
     
     float xpxl1 = xend;
-    float ypxl1 = (float) ( (int) (yend));
+    float ypxl1 = ipart(yend);
     
-    if (steep) {
-        plot<ColorT>(img, ypxl1, xpxl1, clr * rfpart(yend) * xgap);
-        for (int i=1; i<w; i++) {
-            plot<ColorT>(img, ypxl1+i, xpxl1, clr * 1);
-        }
-        plot<ColorT>(img, ypxl1+ipart(w), xpxl1, clr * fpart(yend) * xgap);
-    }
-    else {
-        plot<ColorT>(img, xpxl1, ypxl1, clr * rfpart(yend) * xgap);
-        for (int i=1; i<w; i++) {
-            plot<ColorT>(img, xpxl1, ypxl1+i, clr * 1);
-        }
-        plot<ColorT>(img, xpxl1, ypxl1+ipart(w), clr * fpart(yend) * xgap);
+    if (range_x0 <= x0 && xpxl1 >= along0 && xpxl1 < along1) {
+        if (steep) line_column_pixels<true>(xpxl1, ypxl1, w, clr * rfpart(yend) * xgap, clr, clr * fpart(yend) * xgap, across0, across1, pixel);
+        else line_column_pixels<false>(xpxl1, ypxl1, w, clr * rfpart(yend) * xgap, clr, clr * fpart(yend) * xgap, across0, across1, pixel);
     }
     
-    float intery = yend + gradient;
-    
     xend = round(x1);
     yend = y1 + gradient * (xend - x1);
     xgap = fpart(x1 + 0.5);
     
     float xpxl2 = xend; //this will be used in the main loop
-    float ypxl2 = (float)((int)(yend));
-    if (steep) {
-        plot<ColorT>(img, ypxl2, xpxl2, clr * rfpart(yend) * xgap);
-        for (int i=1; i<w; i++) {
-            plot<ColorT>(img, ypxl2+i, xpxl2, clr * 1);
-        }
-        plot<ColorT>(img, ypxl2+ipart(w), xpxl2, clr * fpart(yend) * xgap);
-    }
-    else {
-        plot<ColorT>(img, xpxl2, ypxl2, clr * rfpart(yend) * xgap);
-        for (int i=1; i<w; i++) {
-            plot<ColorT>(img, xpxl2, ypxl2+i, clr * 1);
-        }
-        plot<ColorT>(img, xpxl2, ypxl2+ipart(w), clr * fpart(yend) * xgap);
+    float ypxl2 = ipart(yend);
+    if (range_x1 >= x1 && xpxl2 >= along0 && xpxl2 < along1) {
+        if (steep) line_column_pixels<true>(xpxl2, ypxl2, w, clr * rfpart(yend) * xgap, clr, clr * fpart(yend) * xgap, across0, across1, pixel);
+        else line_column_pixels<false>(xpxl2, ypxl2, w, clr * rfpart(yend) * xgap, clr, clr * fpart(yend) * xgap, across0, across1, pixel);
     }
     
-    // main loop
+    // main loop, edge colors are the same for every column
+    ColorT clr_top = clr * rfpart(yend) * xgap, clr_bottom = clr * fpart(yend) * xgap;
+    float x_first = std::max({xpxl1 + 1, ceilf(range_x0), along0}), x_last = std::min({xpxl2 - 1, floorf(range_x1), along1 - 1});
     if (steep) {
-        for (int x = xpxl1 + 1;  x <= xpxl2 - 1; x++) {
-            plot<ColorT>(img, ipart(intery), x, clr * rfpart(yend) * xgap);
-            for (int i=1; i<w; i++) {
-                plot<ColorT>(img, ipart(intery)+i, x, clr * 1);
-            }
-            plot<ColorT>(img, ipart(intery)+ipart(w), x, clr * fpart(yend) * xgap);
-            intery = intery + gradient;
+        for (int x = x_first; x <= x_last; x++) {
+            float intery = row_at(x);
+            line_column_pixels<true>(x, ipart(intery), w, clr_top, clr, clr_bottom, across0, across1, pixel);
         }
     }
     else {
-        for (int x = xpxl1 + 1; x <= xpxl2 - 1; x++) {
-            plot<ColorT>(img, x, ipart(intery), clr * rfpart(yend) * xgap);
-            for (int i=1; i<w; i++) {
-                plot<ColorT>(img, x, ipart(intery)+i, clr * 1);
-            }
-            plot<ColorT>(img, x, ipart(intery)+ipart(w), clr * fpart(yend) * xgap);
-            
-            intery = intery + gradient;
+        for (int x = x_first; x <= x_last; x++) {
+            float intery = row_at(x);
+            line_column_pixels<false>(x, ipart(intery), w, clr_top, clr, clr_bottom, across0, across1, pixel);
         }
     }
 }
 
 
-template<class ColorT>
-void add_line_edge(Image &img, 
+template<class ColorT, class Pixel>
+void add_line_edge_pixels(
     float x0, float y0,
     float x1, float y1,
     ColorT clr,
     float thickness,
-    float k
+    PointF from, PointF to,
+    const ClipRect &clip,
+    Pixel &&pixel
 ) {
     bool steep = abs(y1-y0) > abs(x1 - x0); 
 
     if (steep) {
         swap(x0, y0);
         swap(x1, y1);
+        swap(from.x, from.y);
+        swap(to.x, to.y);
     }
     
     if (x0 > x1) {
         swap(x0, x1);
         swap(y0, y1);
     }
+    // columns of the part to draw, ends are drawn only if they are not cut off
+    float range_x0 = std::min(from.x, to.x), range_x1 = std::max(from.x, to.x);
+    // columns & rows of the clip, along the line & across it
+    float along0 = steep ? clip.y0 : clip.x0, along1 = steep ? clip.y1 : clip.x1;
+    float across0 = steep ? clip.x0 : clip.y0, across1 = steep ? clip.x1 : clip.y1;
     
     float dx = x1 - x0;
     float dy = y1 - y0;
@@ -226,6 +753,11 @@ void add_line_edge(Image &img,
     else            gradient = dy/dx;
     
     float w = thickness * sqrt(1 + (gradient * gradient));
+    // row of the line at column x, from the end points in double & the same for every column however the walk is clipped
+    // (ends may be far out of the clip, float steps from them would drift)
+    double slope = dx == 0 ? 1 : ((double)y1 - y0)/((double)x1 - x0);
+    float offset = -(w-1)/2;
+    auto row_at = [&](int x) { return (float)(y0 + offset + slope*(x - (double)x0)); };
 
     // float xend = round(x0);
     // float yend = y0 + (w-1)/2 + gradient*(xend - x0);
@@ -235,25 +767,13 @@ void add_line_edge(Image &img,
     float xgap = 1 - (x0 + 0.5 - xend);
     
     float xpxl1 = xend;
-    float ypxl1 = (float) ( (int) (yend));
+    float ypxl1 = ipart(yend);
     
-    if (steep) {
-        plot_add<ColorT>(img, ypxl1, xpxl1, clr * 1, k);
-        for (int i=1; i<w; i++) {
-            plot_add<ColorT>(img, ypxl1+i, xpxl1, clr * 1, k);
-        }
-        plot_add<ColorT>(img, ypxl1+ipart(w), xpxl1, clr * 1, k);
-    }
-    else {
-        plot_add<ColorT>(img, xpxl1, ypxl1, clr * 1, k);
-        for (int i=1; i<w; i++) {
-            plot_add<ColorT>(img, xpxl1, ypxl1+i, clr * 1, k);
-        }
-        plot_add<ColorT>(img, xpxl1, ypxl1+ipart(w), clr * 1, k);
+    if (range_x0 <= x0 && xpxl1 >= along0 && xpxl1 < along1) {
+        if (steep) line_column_pixels<true>(xpxl1, ypxl1, w, clr, clr, clr, across0, across1, pixel);
+        else line_column_pixels<false>(xpxl1, ypxl1, w, clr, clr, clr, across0, across1, pixel);
     }
     
-    float intery = yend + gradient;
-    
     // xend = round(x1);
     // yend = y1 + gradient * (xend - x1);
     // xgap = fpart(x1 + 0.5);
@@ -262,65 +782,57 @@ void add_line_edge(Image &img,
     xgap = 1 - (x1 + 0.5 - xend);
     
     float xpxl2 = xend; //this will be used in the main loop
-    float ypxl2 = (float)((int)(yend));
-    if (steep) {
-        plot_add<ColorT>(img, ypxl2, xpxl2, clr * rfpart(yend) * xgap, k);
-        for (int i=1; i<w; i++) {
-            plot_add<ColorT>(img, ypxl2+i, xpxl2, clr * 1, k);
-        }
-        plot_add<ColorT>(img, ypxl2+ipart(w), xpxl2, clr * fpart(yend) * xgap, k);
-    }
-    else {
-        plot_add<ColorT>(img, xpxl2, ypxl2, clr * rfpart(yend) * xgap, k);
-        for (int i=1; i<w; i++) {
-            plot_add<ColorT>(img, xpxl2, ypxl2+i, clr * 1, k);
-        }
-        plot_add<ColorT>(img, xpxl2, ypxl2+ipart(w), clr * fpart(yend) * xgap, k);
+    float ypxl2 = ipart(yend);
+    if (range_x1 >= x1 && xpxl2 >= along0 && xpxl2 < along1) {
+        if (steep) line_column_pixels<true>(xpxl2, ypxl2, w, clr * rfpart(yend) * xgap, clr, clr * fpart(yend) * xgap, across0, across1, pixel);
+        else line_column_pixels<false>(xpxl2, ypxl2, w, clr * rfpart(yend) * xgap, clr, clr * fpart(yend) * xgap, across0, across1, pixel);
     }
     
-    // main loop
+    // main loop, edge colors are the same for every column
+    ColorT clr_top = clr * rfpart(yend) * xgap, clr_bottom = clr * fpart(yend) * xgap;
+    float x_first = std::max({xpxl1 + 1, ceilf(range_x0), along0}), x_last = std::min({xpxl2 - 1, floorf(range_x1), along1 - 1});
     if (steep) {
-        for (int x = xpxl1 + 1;  x <= xpxl2 - 1; x++) {
-            plot_add<ColorT>(img, ipart(round(intery)), x, clr * rfpart(yend) * xgap, k);
-            for (int i=1; i<w; i++) {
-                plot_add<ColorT>(img, ipart(round(intery))+i, x, clr * 1, k);
-            }
-            plot_add<ColorT>(img, ipart(round(intery))+ipart(w), x, clr * fpart(yend) * xgap, k);
-            intery = intery + gradient;
+        for (int x = x_first; x <= x_last; x++) {
+            float intery = row_at(x);
+            line_column_pixels<true>(x, ipart(round(intery)), w, clr_top, clr, clr_bottom, across0, across1, pixel);
         }
     }
     else {
-        for (int x = xpxl1 + 1; x <= xpxl2 - 1; x++) {
-            plot_add<ColorT>(img, x, ipart(round(intery)), clr * rfpart(yend) * xgap, k);
-            for (int i=1; i<w; i++) {
-                plot_add<ColorT>(img, x, ipart(round(intery))+i, clr * 1, k);
-            }
-            plot_add<ColorT>(img, x, ipart(round(intery))+ipart(w), clr * fpart(yend) * xgap, k);
-
-            intery = intery + gradient;
+        for (int x = x_first; x <= x_last; x++) {
+            float intery = row_at(x);
+            line_column_pixels<false>(x, ipart(round(intery)), w, clr_top, clr, clr_bottom, across0, across1, pixel);
         }
     }
 }
 
-template<class ColorT>
-void add_line_noedge(Image &img, 
+template<class ColorT, class Pixel>
+void add_line_noedge_pixels(
     float x0, float y0,
     float x1, float y1,
     ColorT clr,
     float thickness,
-    float k
+    PointF from, PointF to,
+    const ClipRect &clip,
+    Pixel &&pixel
 ) {
     bool steep = abs(y1-y0) > abs(x1 - x0); 
 
     if (steep) {
         swap(x0, y0);
         swap(x1, y1);
+        swap(from.x, from.y);
+        swap(to.x, to.y);
     }
     
     if (x0 > x1) {
         swap(x0, x1);
         swap(y0, y1);
     }
+    // columns of the part to draw, ends are drawn only if they are not cut off
+    float range_x0 = std::min(from.x, to.x), range_x1 = std::max(from.x, to.x);
+    // columns & rows of the clip, along the line & across it
+    float along0 = steep ? clip.y0 : clip.x0, along1 = steep ? clip.y1 : clip.x1;
+    float across0 = steep ? clip.x0 : clip.y0, across1 = steep ? clip.x1 : clip.y1;
     
     float dx = x1 - x0;
     float dy = y1 - y0;
@@ -330,74 +842,982 @@ void add_line_noedge(Image &img,
     else            gradient = dy/dx;
     
     float w = thickness * sqrt(1 + (gradient * gradient));
+    // row of the line at column x, from the end points in double & the same for every column however the walk is clipped
+    // (ends may be far out of the clip, float steps from them would drift)
+    double slope = dx == 0 ? 1 : ((double)y1 - y0)/((double)x1 - x0);
+    float offset = -(w-1)/2;
+    auto row_at = [&](int x) { return (float)(y0 + offset + slope*(x - (double)x0)); };
 
     float xend = round(x0);
     float yend = y0 - (w-1)/2 + gradient * (xend - x0);
     float xgap = 1 - (x0 + 0.5 - xend);
     
     float xpxl1 = xend;
-    float ypxl1 = (float) ( (int) (yend));
+    float ypxl1 = ipart(yend);
     
-    if (steep) {
-        plot_add<ColorT>(img, ypxl1, xpxl1, clr * 1, k);
-        for (int i=1; i<w; i++) {
-            plot_add<ColorT>(img, ypxl1+i, xpxl1, clr * 1, k);
-        }
-        plot_add<ColorT>(img, ypxl1+ipart(w), xpxl1, clr * 1, k);
-    }
-    else {
-        plot_add<ColorT>(img, xpxl1, ypxl1, clr * 1, k);
-        for (int i=1; i<w; i++) {
-            plot_add<ColorT>(img, xpxl1, ypxl1+i, clr * 1, k);
-        }
-        plot_add<ColorT>(img, xpxl1, ypxl1+ipart(w), clr * 1, k);
+    if (range_x0 <= x0 && xpxl1 >= along0 && xpxl1 < along1) {
+        if (steep) line_column_pixels<true>(xpxl1, ypxl1, w, clr, clr, clr, across0, across1, pixel);
+        else line_column_pixels<false>(xpxl1, ypxl1, w, clr, clr, clr, across0, across1, pixel);
     }
     
-    float intery = yend + gradient;
-    
     xend = round(x1);
     yend = y1 - (w-1)/2 + gradient * (xend - x1);
     xgap = 1 - (x1 + 0.5 - xend);
     
     float xpxl2 = xend; //this will be used in the main loop
-    float ypxl2 = (float)((int)(yend));
+    float ypxl2 = ipart(yend);
+    if (range_x1 >= x1 && xpxl2 >= along0 && xpxl2 < along1) {
+        if (steep) line_column_pixels<true>(xpxl2, ypxl2, w, clr, clr, clr, across0, across1, pixel);
+        else line_column_pixels<false>(xpxl2, ypxl2, w, clr, clr, clr, across0, across1, pixel);
+    }
+
+    // main loop
+    float x_first = std::max({xpxl1 + 1, ceilf(range_x0), along0}), x_last = std::min({xpxl2 - 1, floorf(range_x1), along1 - 1});
     if (steep) {
-        plot_add<ColorT>(img, ypxl2, xpxl2, clr * 1, k);
-        for (int i=1; i<w; i++) {
-            plot_add<ColorT>(img, ypxl2+i, xpxl2, clr * 1, k);
+        for (int x = x_first; x <= x_last; x++) {
+            float intery = row_at(x);
+            line_column_pixels<true>(x, ipart(round(intery)), w, clr, clr, clr, across0, across1, pixel);
         }
-        plot_add<ColorT>(img, ypxl2+ipart(w), xpxl2, clr * 1, k);
     }
     else {
-        plot_add<ColorT>(img, xpxl2, ypxl2, clr * 1, k);
-        for (int i=1; i<w; i++) {
-            plot_add<ColorT>(img, xpxl2, ypxl2+i, clr * 1, k);
+        for (int x = x_first; x <= x_last; x++) {
+            float intery = row_at(x);
+            line_column_pixels<false>(x, ipart(round(intery)), w, clr, clr, clr, across0, across1, pixel);
         }
-        plot_add<ColorT>(img, xpxl2, ypxl2+ipart(w), clr * 1, k);
     }
+}
 
-    // main loop
-    if (steep) {
-        for (int x = xpxl1 + 1;  x <= xpxl2 - 1; x++) {
-            plot_add<ColorT>(img, ipart(round(intery)), x, clr * 1, k);
-            for (int i=1; i<w; i++) {
-                plot_add<ColorT>(img, ipart(round(intery))+i, x, clr * 1, k);
+template<class ColorT>
+void draw_line(ImageView img, float x0, float y0, float x1, float y1, ColorT clr, float thickness) {
+    draw_line_pixels(x0, y0, x1, y1, clr, thickness, {x0, y0}, {x1, y1}, ClipRect::unbounded(), [&](float x, float y, ColorT c) { plot<ColorT>(img, x, y, c); });
+}
+
+template<class ColorT>
+void add_line_edge(ImageView img, float x0, float y0, float x1, float y1, ColorT clr, float thickness, float k) {
+    uint8_t alpha = blend_alpha(k);
+    add_line_edge_pixels(x0, y0, x1, y1, clr, thickness, {x0, y0}, {x1, y1}, ClipRect::unbounded(), [&](float x, float y, ColorT c) { plot_blend<ColorT>(img, x, y, c, alpha); });
+}
+
+template<class ColorT>
+void add_line_noedge(ImageView img, float x0, float y0, float x1, float y1, ColorT clr, float thickness, float k) {
+    uint8_t alpha = blend_alpha(k);
+    add_line_noedge_pixels(x0, y0, x1, y1, clr, thickness, {x0, y0}, {x1, y1}, ClipRect::unbounded(), [&](float x, float y, ColorT c) { plot_blend<ColorT>(img, x, y, c, alpha); });
+}
+
+// Cuts the segment from-to to clip & image, grown so that pixels of the cut ends stay out of them.
+// Lines plot up to thickness*sqrt(2) + 1 pixels across, ends are rounded to pixels.
+inline bool clip_line(ImageView img, ClipRect &clip, PointF &from, PointF &to, float thickness) {
+    clip = clip.intersection(ClipRect(img));
+    if (clip.empty()) return false;
+    float margin = 2*fabsf(thickness) + 2;
+    return clip_segment(from.x, from.y, to.x, to.y, clip.x0 - margin, clip.y0 - margin, clip.x1 - 1 + margin, clip.y1 - 1 + margin);
+}
+
+template<class ColorT>
+void draw_line(ImageView img, const ClipRect &clip, float x0, float y0, float x1, float y1, ColorT clr, float thickness) {
+    ClipRect box = clip;
+    PointF from{x0, y0}, to{x1, y1};
+    if (!clip_line(img, box, from, to, thickness)) return;
+    draw_line_pixels(x0, y0, x1, y1, clr, thickness, from, to, box, [&](float x, float y, ColorT c) { plot<ColorT>(img, box, x, y, c); });
+}
+
+template<class ColorT>
+void add_line_edge(ImageView img, const ClipRect &clip, float x0, float y0, float x1, float y1, ColorT clr, float thickness, float k) {
+    ClipRect box = clip;
+    PointF from{x0, y0}, to{x1, y1};
+    if (!clip_line(img, box, from, to, thickness)) return;
+    uint8_t alpha = blend_alpha(k);
+    add_line_edge_pixels(x0, y0, x1, y1, clr, thickness, from, to, box, [&](float x, float y, ColorT c) { plot_blend<ColorT>(img, box, x, y, c, alpha); });
+}
+
+template<class ColorT>
+void add_line_noedge(ImageView img, const ClipRect &clip, float x0, float y0, float x1, float y1, ColorT clr, float thickness, float k) {
+    ClipRect box = clip;
+    PointF from{x0, y0}, to{x1, y1};
+    if (!clip_line(img, box, from, to, thickness)) return;
+    uint8_t alpha = blend_alpha(k);
+    add_line_noedge_pixels(x0, y0, x1, y1, clr, thickness, from, to, box, [&](float x, float y, ColorT c) { plot_blend<ColorT>(img, box, x, y, c, alpha); });
+}
+
+void Path::move_to(float x, float y) {
+    this->close();
+    this->points.push_back({x, y});
+}
+
+void Path::line_to(float x, float y) {
+    size_t begin = this->ends.empty() ? 0 : this->ends.back();
+    // a contour after close() continues from the last point
+    if (this->points.size() == begin && begin > 0) this->points.push_back(this->points.back());
+    this->points.push_back({x, y});
+}
+
+void Path::close() {
+    size_t begin = this->ends.empty() ? 0 : this->ends.back();
+    if (this->points.size() > begin) this->ends.push_back(this->points.size());
+}
+
+void Path::add_polygon(std::span<const PointF> polygon) {
+    this->close();
+    this->points.insert(this->points.end(), polygon.begin(), polygon.end());
+    this->close();
+}
+
+void Path::clear() {
+    this->points.clear();
+    this->ends.clear();
+}
+
+void Rasterizer::reset(int x0, int y0, int x1, int y1) {
+    this->edges.clear();
+    this->clip_x0 = x0;
+    this->clip_y0 = y0;
+    this->clip_x1 = std::max(x0, x1);
+    this->clip_y1 = std::max(y0, y1);
+    this->min_y = INFINITY;
+    this->max_y = -INFINITY;
+}
+
+// edge in pixel area coordinates (pixel x covers [x, x + 1)), y0 < y1
+void Rasterizer::add_edge(float x0, float y0, float x1, float y1, int dir) {
+    this->edges.push_back({x0, y0, x1, y1, (x1 - x0)/(y1 - y0), (y1 - y0)/(x1 - x0), dir});
+    this->min_y = std::min(this->min_y, y0);
+    this->max_y = std::max(this->max_y, y1);
+}
+
+void Rasterizer::add_line(PointF a, PointF b) {
+    // pixel centers are at integers
+    float x0 = a.x + 0.5f, y0 = a.y + 0.5f, x1 = b.x + 0.5f, y1 = b.y + 0.5f;
+    if (!(y0 != y1) || !isfinite(x0) || !isfinite(x1) || !isfinite(y0) || !isfinite(y1)) return;
+    int dir = 1;
+    if (y0 > y1) {
+        swap(x0, x1);
+        swap(y0, y1);
+        dir = -1;
+    }
+    if (y1 <= this->clip_y0 || y0 >= this->clip_y1) return;
+
+    // split where the edge crosses the sides of the clip box: parts outside still change the winding
+    // of pixels right of them, so they are moved onto the sides as vertical edges
+    float left = this->clip_x0, right = this->clip_x1;
+    float t[4] = {0, 0, 0, 1};
+    int parts = 1;
+    if ((x0 < left) != (x1 < left)) t[parts++] = (left - x0)/(x1 - x0);
+    if ((x0 > right) != (x1 > right)) t[parts++] = (right - x0)/(x1 - x0);
+    if (parts == 3 && t[1] > t[2]) swap(t[1], t[2]);
+    t[parts] = 1;
+
+    float ya = y0, xa = std::clamp(x0, left, right);
+    for (int i=1; i<=parts; i++) {
+        float yb = i == parts ? y1 : y0 + (y1 - y0)*t[i];
+        float xb = std::clamp(i == parts ? x1 : x0 + (x1 - x0)*t[i], left, right);
+        if (yb > ya) this->add_edge(xa, ya, xb, yb, dir);
+        xa = xb;
+        ya = yb;
+    }
+}
+
+void Rasterizer::add_polygon(std::span<const PointF> polygon) {
+    for (size_t i=0; i<polygon.size(); i++) {
+        this->add_line(polygon[i], polygon[i + 1 < polygon.size() ? i + 1 : 0]);
+    }
+}
+
+void Rasterizer::add_path(const Path &path) {
+    size_t begin = 0;
+    for (size_t end: path.ends) {
+        this->add_polygon(std::span<const PointF>(path.points).subspan(begin, end - begin));
+        begin = end;
+    }
+    // the current contour is closed too
+    if (path.points.size() > begin) this->add_polygon(std::span<const PointF>(path.points).subspan(begin));
+}
+
+void Rasterizer::add_stroke(std::span<const PointF> polyline, float thickness, bool closed) {
+    float half = thickness/2;
+    if (!(half > 0) || polyline.size() < 2) return;
+
+    // offsets of segments to their left (as seen along the segment), zero for empty segments
+    size_t segments = closed ? polyline.size() : polyline.size() - 1;
+    auto offset = [&](size_t i) {
+        PointF a = polyline[i], b = polyline[(i + 1) % polyline.size()];
+        float length = sqrtf((b.x - a.x)*(b.x - a.x) + (b.y - a.y)*(b.y - a.y));
+        if (length == 0) return PointF{0, 0};
+        return PointF{(a.y - b.y)/length*half, (b.x - a.x)/length*half};
+    };
+
+    PointF previous{0, 0};
+    bool has_previous = false;
+    for (size_t i=0; i<segments; i++) {
+        PointF n = offset(i);
+        if (n.x == 0 && n.y == 0) continue;
+        PointF a = polyline[i], b = polyline[(i + 1) % polyline.size()];
+        PointF quad[4] = {{a.x + n.x, a.y + n.y}, {b.x + n.x, b.y + n.y}, {b.x - n.x, b.y - n.y}, {a.x - n.x, a.y - n.y}};
+        this->add_polygon(quad);
+
+        // bevel between this segment and the previous one
+        if (has_previous) this->add_bevel(a, previous, n);
+        previous = n;
+        has_previous = true;
+    }
+    if (closed && has_previous) {
+        // join at the first point with the first non-empty segment
+        for (size_t i=0; i<segments; i++) {
+            PointF n = offset(i);
+            if (n.x == 0 && n.y == 0) continue;
+            this->add_bevel(polyline[i], previous, n);
+            break;
+        }
+    }
+}
+
+void Rasterizer::add_bevel(PointF p, PointF n0, PointF n1) {
+    // rectangles of add_stroke have negative cross product orientation, triangles get it too
+    for (float side: {1.0f, -1.0f}) {
+        PointF a{p.x + side*n0.x, p.y + side*n0.y}, b{p.x + side*n1.x, p.y + side*n1.y};
+        float cross = (a.x - p.x)*(b.y - p.y) - (a.y - p.y)*(b.x - p.x);
+        if (cross == 0) continue;
+        PointF triangle[3] = {p, cross < 0 ? a : b, cross < 0 ? b : a};
+        this->add_polygon(triangle);
+    }
+}
+
+// Cells of the part of edge between y0 & y1 (within one row): the part is split at pixel borders
+inline void Rasterizer::add_cells(const Edge &edge, float y0, float y1) {
+    float x_min = std::min(edge.x0, edge.x1), x_max = std::max(edge.x0, edge.x1);
+    float xa = std::clamp(edge.x0 + (y0 - edge.y0)*edge.dxdy, x_min, x_max);
+    float xb = std::clamp(edge.x0 + (y1 - edge.y0)*edge.dxdy, x_min, x_max);
+    int x = raster_floor(xa), x_end = raster_floor(xb);
+
+    size_t count = this->cell_count + std::abs(x_end - x) + 1;
+    if (count > this->cells.size()) this->cells.resize(std::max(count, 2*this->cells.size()));
+    Cell *cells = this->cells.data();
+    auto add = [&](int x, float x_from, float x_to, float height) {
+        float d = edge.dir*height;
+        cells[this->cell_count++] = {x, d, d*(1 - ((x_from + x_to)*0.5f - x))};
+    };
+
+    if (x == x_end) {
+        add(x, xa, xb, y1 - y0);
+        return;
+    }
+    // walk pixel borders the part crosses, y at a border is on the edge line
+    int step = x < x_end ? 1 : -1;
+    float x_from = xa, ya = y0;
+    while (x != x_end) {
+        float border = step > 0 ? x + 1 : x;
+        float y = std::min(y0 + (border - xa)*edge.dydx, y1);
+        add(x, x_from, border, y - ya);
+        ya = y;
+        x_from = border;
+        x += step;
+    }
+    add(x_end, x_from, xb, y1 - ya);
+}
+
+// 0 below half of the 8-bit step, so rounding errors of windings do not make spans
+inline float Rasterizer::coverage(float winding) const {
+    float c = fabsf(winding);
+    if (this->rule == FILL_EVENODD) {
+        c = fmodf(c, 2.0f);
+        if (c > 1) c = 2 - c;
+    }
+    return c < 0.5f/255 ? 0 : std::min(c, 1.0f);
+}
+
+template<class F>
+void Rasterizer::sweep(F &&span) {
+    if (this->edges.empty()) return;
+    std::sort(this->edges.begin(), this->edges.end(), [](const Edge &a, const Edge &b) { return a.y0 < b.y0; });
+
+    // clamped to the clip in float, far vertices would overflow int
+    float y_min = floorf(this->min_y), y_max = ceilf(this->max_y);
+    int y_begin = y_min > this->clip_y0 ? (y_min < this->clip_y1 ? (int)y_min : this->clip_y1) : this->clip_y0;
+    int y_end = y_max < this->clip_y1 ? (y_max > this->clip_y0 ? (int)y_max : this->clip_y0) : this->clip_y1;
+    this->active.clear();
+    size_t next = 0;
+    for (int y=y_begin; y<y_end; y++) {
+        float top = y, bottom = y + 1;
+
+        // active edge table: edges crossing the row
+        size_t kept = 0;
+        for (int i: this->active) {
+            if (this->edges[i].y1 > top) this->active[kept++] = i;
+        }
+        this->active.resize(kept);
+        for (; next<this->edges.size() && this->edges[next].y0 < bottom; next++) {
+            if (this->edges[next].y1 > top) this->active.push_back(next);
+        }
+        if (this->active.empty()) continue;
+
+        this->cell_count = 0;
+        for (int i: this->active) {
+            const Edge &edge = this->edges[i];
+            this->add_cells(edge, std::max(top, edge.y0), std::min(bottom, edge.y1));
+        }
+        Cell *cells = this->cells.data();
+        size_t count = this->cell_count;
+        // rows of small shapes have a few cells in nearly sorted order
+        if (count <= 32) {
+            for (size_t i=1; i<count; i++) {
+                Cell cell = cells[i];
+                size_t j = i;
+                for (; j>0 && cells[j - 1].x > cell.x; j--) cells[j] = cells[j - 1];
+                cells[j] = cell;
+            }
+        } else {
+            std::sort(cells, cells + count, [](const Cell &a, const Cell &b) { return a.x < b.x; });
+        }
+
+        // winding left of the current cell, pixels between cells have it as coverage
+        float winding = 0;
+        for (size_t i=0; i<count;) {
+            int x = cells[i].x;
+            if (x >= this->clip_x1) break;
+            float area = 0, cover = 0;
+            for (; i<count && cells[i].x == x; i++) {
+                area += cells[i].area;
+                cover += cells[i].cover;
             }
-            plot_add<ColorT>(img, ipart(round(intery))+ipart(w), x, clr * 1, k);
-            intery = intery + gradient;
+            float c = this->coverage(winding + area);
+            if (c > 0) span(y, x, x + 1, c);
+            winding += cover;
+
+            int x_next = i < count ? std::min(cells[i].x, this->clip_x1) : this->clip_x1;
+            c = this->coverage(winding);
+            if (x + 1 < x_next && c > 0) span(y, x + 1, x_next, c);
         }
     }
-    else {
-        for (int x = xpxl1 + 1; x <= xpxl2 - 1; x++) {
-            plot_add<ColorT>(img, x, ipart(round(intery)), clr * 1, k);
-            for (int i=1; i<w; i++) {
-                plot_add<ColorT>(img, x, ipart(round(intery))+i, clr * 1, k);
+}
+
+Rasterizer& Rasterizer::local() {
+    static thread_local Rasterizer rasterizer;
+    return rasterizer;
+}
+
+template<class ColorT>
+void fill_span(ImageView img, int y, int x0, int x1, ColorT clr, uint8_t alpha) {
+    x0 = std::max(x0, 0);
+    x1 = std::min(x1, img.width);
+    if (alpha == 0 || x0 >= x1 || y < 0 || y >= img.height) return;
+    assert(sizeof(ColorT) == (size_t)img.pixel_size());
+
+    ColorT *row = (ColorT*)img.at_unchecked(x0, y);
+    int count = x1 - x0;
+    // edge pixels of shapes come one by one, the row kernels pay off on longer spans
+    if constexpr (requires { PixelTraits<ColorT>::sample; }) {
+        if constexpr (PixelTraits<ColorT>::sample == Image::U8) {
+            if (count >= 16) {
+                if (alpha == 255) fill_row((uint8_t*)row, (const uint8_t*)&clr, PixelTraits<ColorT>::channels, count);
+                else blend_fill_row((uint8_t*)row, (const uint8_t*)&clr, PixelTraits<ColorT>::channels, count, alpha);
+                return;
+            }
+        }
+    }
+    if (alpha == 255) {
+        std::fill(row, row + count, clr);
+        return;
+    }
+    for (int i=0; i<count; i++) blend(row[i], clr, alpha);
+}
+
+// Rasterizer of the thread clipped to clip & img, nullptr if nothing is left
+inline Rasterizer* clipped_rasterizer(ImageView img, const ClipRect &clip) {
+    ClipRect box = clip.intersection(ClipRect(img));
+    if (box.empty()) return nullptr;
+    Rasterizer &rasterizer = Rasterizer::local();
+    rasterizer.reset(box.x0, box.y0, box.x1, box.y1);
+    return &rasterizer;
+}
+
+template<class ColorT>
+void fill_polygon(ImageView img, const ClipRect &clip, std::span<const PointF> polygon, ColorT clr, float k, FillRule rule) {
+    Rasterizer *rasterizer = clipped_rasterizer(img, clip);
+    if (!rasterizer) return;
+    rasterizer->rule = rule;
+    rasterizer->add_polygon(polygon);
+    rasterizer->sweep([&](int y, int x0, int x1, float coverage) {
+        fill_span(img, y, x0, x1, clr, blend_alpha(coverage*k));
+    });
+}
+
+template<class ColorT>
+void fill_polygon(ImageView img, std::span<const PointF> polygon, ColorT clr, float k, FillRule rule) {
+    fill_polygon(img, ClipRect(img), polygon, clr, k, rule);
+}
+
+template<class ColorT>
+void fill_path(ImageView img, const ClipRect &clip, const Path &path, ColorT clr, float k, FillRule rule) {
+    Rasterizer *rasterizer = clipped_rasterizer(img, clip);
+    if (!rasterizer) return;
+    rasterizer->rule = rule;
+    rasterizer->add_path(path);
+    rasterizer->sweep([&](int y, int x0, int x1, float coverage) {
+        fill_span(img, y, x0, x1, clr, blend_alpha(coverage*k));
+    });
+}
+
+template<class ColorT>
+void fill_path(ImageView img, const Path &path, ColorT clr, float k, FillRule rule) {
+    fill_path(img, ClipRect(img), path, clr, k, rule);
+}
+
+bool clip_segment(float &x0, float &y0, float &x1, float &y1, float x_min, float y_min, float x_max, float y_max) {
+    // in double: ends far out of the box (1e9 px) would move the cut ends by whole pixels in float
+    double dx = (double)x1 - x0, dy = (double)y1 - y0;
+    // segment is x0 + t*dx for t in [t0, t1], every side of the box cuts the range
+    double t0 = 0, t1 = 1;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {(double)x0 - x_min, (double)x_max - x0, (double)y0 - y_min, (double)y_max - y0};
+    for (int i=0; i<4; i++) {
+        if (p[i] == 0) {
+            // parallel to the side
+            if (q[i] < 0) return false;
+            continue;
+        }
+        double t = q[i]/p[i];
+        if (p[i] < 0) t0 = std::max(t0, t);
+        else t1 = std::min(t1, t);
+    }
+    if (t0 > t1) return false;
+
+    // the kept end stays exact
+    double sx = x0, sy = y0;
+    if (t1 < 1) {
+        x1 = sx + t1*dx;
+        y1 = sy + t1*dy;
+    }
+    if (t0 > 0) {
+        x0 = sx + t0*dx;
+        y0 = sy + t0*dy;
+    }
+    return true;
+}
+
+// narrows [x0, x1] to x where lo <= a + b*x <= hi, inv_b is 1/b
+inline void narrow_linear(float a, float b, float inv_b, float lo, float hi, float &x0, float &x1) {
+    if (fabsf(b) < 1e-6f) {
+        if (a < lo || a > hi) x1 = x0 - 1;
+        return;
+    }
+    float t0 = (lo - a)*inv_b, t1 = (hi - a)*inv_b;
+    if (b < 0) swap(t0, t1);
+    x0 = std::max(x0, t0);
+    x1 = std::min(x1, t1);
+}
+
+// hints that memory at p is going to be used soon
+static inline void prefetch(const uint8_t *p) {
+#if defined(STB_IMAGE_WRAPPER_AVX2) || defined(STB_IMAGE_WRAPPER_SSE2)
+    _mm_prefetch((const char*)p, _MM_HINT_T0);
+#else
+    (void)p;
+#endif
+}
+
+template<class ColorT>
+void stroke_line(ImageView img, const ClipRect &clip, float x0, float y0, float x1, float y1, ColorT clr, float thickness, float k) {
+    float half = thickness/2;
+    ClipRect box = clip.intersection(ClipRect(img));
+    if (!(half > 0) || !(k > 0) || box.empty()) return;
+    assert(sizeof(ColorT) == (size_t)img.pixel_size());
+
+    // nothing farther than half + 1 from the center line is touched, so ends cut beyond it are not visible.
+    // The line is cut to the image first & to clip only for the range of rows,
+    // so pixels come out the same for any clip (as in tiles of Canvas).
+    float margin = half + 1;
+    if (!clip_segment(x0, y0, x1, y1, -margin, -margin, img.width - 1 + margin, img.height - 1 + margin)) return;
+    float clip_x0 = x0, clip_y0 = y0, clip_x1 = x1, clip_y1 = y1;
+    if (!clip_segment(clip_x0, clip_y0, clip_x1, clip_y1, box.x0 - margin, box.y0 - margin, box.x1 - 1 + margin, box.y1 - 1 + margin)) return;
+
+    float length = sqrtf((x1 - x0)*(x1 - x0) + (y1 - y0)*(y1 - y0));
+    if (length == 0) return;
+    // along & across the line, u from 0 to length, d from -half to half
+    float tx = (x1 - x0)/length, ty = (y1 - y0)/length;
+    float nx = -ty, ny = tx;
+    float inv_nx = 1/nx, inv_tx = 1/tx;
+
+    // a pixel is covered by the product of its overlaps with the line across & along it
+    auto coverage = [&](float d, float u) {
+        float across = std::min(d + half, 0.5f) - std::max(d - half, -0.5f);
+        float along = std::min(u + 0.5f, length) - std::max(u - 0.5f, 0.0f);
+        return std::max(across, 0.0f) * std::max(along, 0.0f);
+    };
+
+    float extent_y = (half + 0.5f)*fabsf(tx) + 0.5f*fabsf(ty);
+    int row_begin = std::max(box.y0, -raster_floor(extent_y - std::min(clip_y0, clip_y1)));
+    int row_end = std::min(box.y1 - 1, raster_floor(std::max(clip_y0, clip_y1) + extent_y));
+    uint8_t alpha = blend_alpha(k);
+
+    for (int y=row_begin; y<=row_end; y++) {
+        // d & u in this row are linear in x
+        float d_row = (y - y0)*ny - x0*nx;
+        float u_row = (y - y0)*ty - x0*tx;
+
+        // touched pixels
+        float touch_x0 = box.x0, touch_x1 = box.x1 - 1;
+        narrow_linear(d_row, nx, inv_nx, -half - 0.5f, half + 0.5f, touch_x0, touch_x1);
+        narrow_linear(u_row, tx, inv_tx, -0.5f, length + 0.5f, touch_x0, touch_x1);
+        if (touch_x0 > touch_x1) continue;
+        int begin = -raster_floor(-touch_x0), end = raster_floor(touch_x1);
+
+        // fully covered pixels
+        float full_x0 = begin, full_x1 = end;
+        narrow_linear(d_row, nx, inv_nx, -half + 0.5f, half - 0.5f, full_x0, full_x1);
+        narrow_linear(u_row, tx, inv_tx, 0.5f, length - 0.5f, full_x0, full_x1);
+        int full_begin = end + 1, full_end = end;
+        if (full_x0 <= full_x1) {
+            full_begin = -raster_floor(-full_x0);
+            full_end = raster_floor(full_x1);
+        }
+
+        ColorT *row = (ColorT*)img.at_unchecked(0, y);
+        // edge pixels are blended over what is there, start loading the next row while this one is drawn
+        if (y < row_end) {
+            prefetch(img.at_unchecked(begin, y + 1));
+            prefetch(img.at_unchecked(end, y + 1));
+        }
+        auto edge = [&](int x) {
+            uint8_t a = blend_alpha(k*coverage(d_row + x*nx, u_row + x*tx));
+            if (a > 0) blend(row[x], clr, a);
+        };
+        for (int x=begin; x<full_begin; x++) edge(x);
+        fill_span(img, y, full_begin, full_end + 1, clr, alpha);
+        for (int x=std::max(full_begin, full_end + 1); x<=end; x++) edge(x);
+    }
+}
+
+template<class ColorT>
+void stroke_line(ImageView img, float x0, float y0, float x1, float y1, ColorT clr, float thickness, float k) {
+    stroke_line(img, ClipRect(img), x0, y0, x1, y1, clr, thickness, k);
+}
+
+template<class ColorT>
+void stroke_polyline(ImageView img, const ClipRect &clip, std::span<const PointF> polyline, ColorT clr, float thickness, float k, bool closed) {
+    Rasterizer *rasterizer = clipped_rasterizer(img, clip);
+    if (!rasterizer) return;
+    rasterizer->rule = FILL_NONZERO;
+    rasterizer->add_stroke(polyline, thickness, closed);
+    rasterizer->sweep([&](int y, int x0, int x1, float coverage) {
+        fill_span(img, y, x0, x1, clr, blend_alpha(coverage*k));
+    });
+}
+
+template<class ColorT>
+void stroke_polyline(ImageView img, std::span<const PointF> polyline, ColorT clr, float thickness, float k, bool closed) {
+    stroke_polyline(img, ClipRect(img), polyline, clr, thickness, k, closed);
+}
+
+// coverage of the pixel at (dx, dy) from the center by the ellipse of radii 1/inv_rx & 1/inv_ry:
+// its distance to the edge + 1/2, clamped to [0, 1]. The distance is (1 - g)/|grad g|
+// for g = sqrt((dx/rx)^2 + (dy/ry)^2), exact for circles.
+inline float ellipse_coverage(float dx, float dy, float inv_rx, float inv_ry) {
+    float ex = dx*inv_rx, ey = dy*inv_ry;
+    float gx = ex*inv_rx, gy = ey*inv_ry;
+    float g = sqrtf(ex*ex + ey*ey), gradient = sqrtf(gx*gx + gy*gy);
+    float distance = gradient > 0 ? (1 - g)*g/gradient : 1/std::max(inv_rx, inv_ry);
+    return std::clamp(distance + 0.5f, 0.0f, 1.0f);
+}
+
+// Ellipse (or ring between it & the inner ellipse if inner radii are > 0), limited to the sector of sweep radians
+// from start if sweep is less than 2*pi. Angles are parametric on the ellipse of radii arc_rx & arc_ry
+// (the middle of a ring for strokes), so stroke_arc & fill_arc cut ends along the same lines. Every row is cut at the bounds of pixels that are empty, fully covered
+// or on an edge; coverage depends on geometry only, so pixels come out the same for any clip.
+template<class ColorT>
+void draw_ellipse(ImageView img, const ClipRect &clip, float cx, float cy, float rx, float ry, float inner_rx, float inner_ry,
+    float arc_rx, float arc_ry, float start, float sweep, ColorT clr, float k
+) {
+    ClipRect box = clip.intersection(ClipRect(img));
+    if (!(rx > 0 && ry > 0) || !(k > 0) || box.empty() || !std::isfinite(cx) || !std::isfinite(cy)) return;
+    assert(sizeof(ColorT) == (size_t)img.pixel_size());
+
+    bool ring = inner_rx > 0 && inner_ry > 0;
+    bool arc = fabsf(sweep) < 2*(float)M_PI;
+    if (sweep < 0) {
+        start += sweep;
+        sweep = -sweep;
+    }
+    // sides of the sector: unit directions to the points at start & end, distances to them are positive inside.
+    // A sector of up to a half-turn is the intersection of the half-planes, a wider one is their union.
+    if (!(arc_rx > 0 && arc_ry > 0)) {
+        arc_rx = rx;
+        arc_ry = ry;
+    }
+    float ax = arc_rx*cosf(start), ay = arc_ry*sinf(start), bx = arc_rx*cosf(start + sweep), by = arc_ry*sinf(start + sweep);
+    float a_length = sqrtf(ax*ax + ay*ay), b_length = sqrtf(bx*bx + by*by);
+    ax /= a_length;
+    ay /= a_length;
+    bx /= b_length;
+    by /= b_length;
+    bool wide = sweep > (float)M_PI;
+    float inv_ay = -1/ay, inv_by = 1/by;
+
+    // circles & rings of circles take one square root per pixel
+    bool circle = rx == ry && (!ring || inner_rx == inner_ry);
+    float inv_rx = 1/rx, inv_ry = 1/ry, inv_inner_rx = 1/inner_rx, inv_inner_ry = 1/inner_ry;
+    auto coverage = [&](float dx, float dy) {
+        float c;
+        if (circle) {
+            float distance = sqrtf(dx*dx + dy*dy);
+            c = std::clamp(rx - distance + 0.5f, 0.0f, 1.0f);
+            if (ring) c -= std::clamp(inner_rx - distance + 0.5f, 0.0f, 1.0f);
+        } else {
+            c = ellipse_coverage(dx, dy, inv_rx, inv_ry);
+            if (ring) c -= ellipse_coverage(dx, dy, inv_inner_rx, inv_inner_ry);
+        }
+        if (arc) {
+            float side_a = std::clamp(ax*dy - ay*dx + 0.5f, 0.0f, 1.0f);
+            float side_b = std::clamp(dx*by - dy*bx + 0.5f, 0.0f, 1.0f);
+            c *= wide ? std::max(side_a, side_b) : std::min(side_a, side_b);
+        }
+        return c;
+    };
+
+    // nothing farther than a pixel out of the ellipse is touched
+    float top = std::max(cy - ry - 1, (float)box.y0), bottom = std::min(cy + ry + 1, box.y1 - 1.0f);
+    if (!(top <= bottom)) return;
+    uint8_t alpha = blend_alpha(k);
+    struct Range { int begin, end; };
+
+    for (int y=-raster_floor(-top); y<=raster_floor(bottom); y++) {
+        float dy = y - cy;
+        // pixels with centers within half_width of cx
+        float left = box.x0, right = box.x1 - 1;
+        auto range = [&](float half_width) {
+            float x0 = std::max(left, cx - half_width), x1 = std::min(right, cx + half_width);
+            return half_width >= 0 && x0 <= x1 ? Range{-raster_floor(-x0), raster_floor(x1)} : Range{0, -1};
+        };
+        // pixels with centers in the ellipse grown by a pixel (coverage may be above 0)
+        auto touched_range = [&](float rx, float ry) {
+            float t = dy/(ry + 1);
+            return t*t < 1 ? range((rx + 1)*sqrtf(1 - t*t)) : Range{0, -1};
+        };
+        // pixels with all corners in the ellipse (coverage is 1)
+        auto inside_range = [&](float rx, float ry) {
+            float t = (fabsf(dy) + 0.5f)/ry;
+            return t < 1 ? range(rx*sqrtf(1 - t*t) - 0.5f) : Range{0, -1};
+        };
+        Range touched = touched_range(rx, ry);
+        if (touched.begin > touched.end) continue;
+        left = touched.begin, right = touched.end;
+        Range full = inside_range(rx, ry), inner = {0, -1}, hole = {0, -1};
+        if (ring) {
+            inner = touched_range(inner_rx, inner_ry);
+            hole = inside_range(inner_rx, inner_ry);
+        }
+        // narrow sector: pixels it touches & pixels it covers; wide sector: pixels the rest covers & pixels it touches
+        Range sector_out = {0, -1}, sector_in = {0, -1};
+        if (arc) {
+            float side_a = ax*dy + ay*cx, side_b = -dy*bx - cx*by;
+            float lo = wide ? -std::numeric_limits<float>::max() : -0.5f, hi = wide ? -0.5f : std::numeric_limits<float>::max();
+            float x0 = left, x1 = right;
+            narrow_linear(side_a, -ay, inv_ay, lo, hi, x0, x1);
+            narrow_linear(side_b, by, inv_by, lo, hi, x0, x1);
+            sector_out = x0 <= x1 ? Range{-raster_floor(-x0), raster_floor(x1)} : Range{0, -1};
+            lo += 1, hi += 1;
+            x0 = left, x1 = right;
+            narrow_linear(side_a, -ay, inv_ay, lo, hi, x0, x1);
+            narrow_linear(side_b, by, inv_by, lo, hi, x0, x1);
+            sector_in = x0 <= x1 ? Range{-raster_floor(-x0), raster_floor(x1)} : Range{0, -1};
+        }
+
+        auto in = [](Range r, int x) { return x >= r.begin && x <= r.end; };
+        // bounds of ranges in ascending order
+        int cuts[12], count = 0;
+        auto cut = [&](int x) {
+            int i = count++;
+            for (; i > 0 && cuts[i - 1] > x; i--) cuts[i] = cuts[i - 1];
+            cuts[i] = x;
+        };
+        for (Range r: {touched, full, inner, hole, sector_out, sector_in}) {
+            if (r.begin > r.end) continue;
+            cut(r.begin);
+            cut(r.end + 1);
+        }
+
+        ColorT *row = (ColorT*)img.at_unchecked(0, y);
+        // edges are blended over what is there, start loading them in the next row while this one is drawn
+        if (y + 1 < box.y1) {
+            prefetch(img.at_unchecked(touched.begin, y + 1));
+            prefetch(img.at_unchecked(touched.end, y + 1));
+        }
+        for (int i=0; i+1<count; i++) {
+            int x0 = std::max(cuts[i], touched.begin), x1 = std::min(cuts[i + 1], touched.end + 1);
+            if (x0 >= x1) continue;
+            // pixels between cuts are alike
+            bool empty = in(hole, x0) || (arc && in(sector_out, x0) == wide);
+            bool covered = in(full, x0) && !in(inner, x0) && (!arc || in(sector_in, x0) != wide);
+            if (empty) continue;
+            if (covered) {
+                fill_span(img, y, x0, x1, clr, alpha);
+                continue;
+            }
+            for (int x=x0; x<x1; x++) {
+                uint8_t a = blend_alpha(k*coverage(x - cx, dy));
+                if (a > 0) blend(row[x], clr, a);
             }
-            plot_add<ColorT>(img, x, ipart(round(intery))+ipart(w), clr * 1, k);
+        }
+    }
+}
+
+template<class ColorT>
+void fill_ellipse(ImageView img, const ClipRect &clip, float cx, float cy, float rx, float ry, ColorT clr, float k) {
+    draw_ellipse(img, clip, cx, cy, rx, ry, 0, 0, rx, ry, 0, 2*(float)M_PI, clr, k);
+}
+
+template<class ColorT>
+void fill_ellipse(ImageView img, float cx, float cy, float rx, float ry, ColorT clr, float k) {
+    fill_ellipse(img, ClipRect(img), cx, cy, rx, ry, clr, k);
+}
+
+template<class ColorT>
+void stroke_ellipse(ImageView img, const ClipRect &clip, float cx, float cy, float rx, float ry, ColorT clr, float thickness, float k) {
+    float half = thickness/2;
+    if (!(half > 0)) return;
+    draw_ellipse(img, clip, cx, cy, rx + half, ry + half, rx - half, ry - half, rx, ry, 0, 2*(float)M_PI, clr, k);
+}
+
+template<class ColorT>
+void stroke_ellipse(ImageView img, float cx, float cy, float rx, float ry, ColorT clr, float thickness, float k) {
+    stroke_ellipse(img, ClipRect(img), cx, cy, rx, ry, clr, thickness, k);
+}
+
+template<class ColorT>
+void fill_circle(ImageView img, const ClipRect &clip, float cx, float cy, float radius, ColorT clr, float k) {
+    fill_ellipse(img, clip, cx, cy, radius, radius, clr, k);
+}
+
+template<class ColorT>
+void fill_circle(ImageView img, float cx, float cy, float radius, ColorT clr, float k) {
+    fill_ellipse(img, ClipRect(img), cx, cy, radius, radius, clr, k);
+}
+
+template<class ColorT>
+void stroke_circle(ImageView img, const ClipRect &clip, float cx, float cy, float radius, ColorT clr, float thickness, float k) {
+    stroke_ellipse(img, clip, cx, cy, radius, radius, clr, thickness, k);
+}
+
+template<class ColorT>
+void stroke_circle(ImageView img, float cx, float cy, float radius, ColorT clr, float thickness, float k) {
+    stroke_ellipse(img, ClipRect(img), cx, cy, radius, radius, clr, thickness, k);
+}
+
+template<class ColorT>
+void stroke_arc(ImageView img, const ClipRect &clip, float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float thickness, float k) {
+    float half = thickness/2;
+    if (!(half > 0)) return;
+    draw_ellipse(img, clip, cx, cy, rx + half, ry + half, rx - half, ry - half, rx, ry, start, end - start, clr, k);
+}
+
+template<class ColorT>
+void stroke_arc(ImageView img, float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float thickness, float k) {
+    stroke_arc(img, ClipRect(img), cx, cy, rx, ry, start, end, clr, thickness, k);
+}
+
+template<class ColorT>
+void fill_arc(ImageView img, const ClipRect &clip, float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float k) {
+    draw_ellipse(img, clip, cx, cy, rx, ry, 0, 0, rx, ry, start, end - start, clr, k);
+}
+
+template<class ColorT>
+void fill_arc(ImageView img, float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float k) {
+    fill_arc(img, ClipRect(img), cx, cy, rx, ry, start, end, clr, k);
+}
+
+
+template<class ColorT>
+void Canvas<ColorT>::add(Shape shape, std::span<const PointF> shape_points, ColorT clr, float thickness, float k, FillRule rule) {
+    if (shape_points.empty()) return;
+
+    ClipRect clip = this->clips.empty() ? ClipRect::unbounded() : this->clips.back();
+    Command command{shape, clr, thickness, k, rule, (uint32_t)this->points.size(), (uint32_t)shape_points.size(), 0, 0, 0, 0, clip};
+    command.x0 = command.x1 = shape_points[0].x;
+    command.y0 = command.y1 = shape_points[0].y;
+    if (shape >= SHAPE_ELLIPSE) {
+        // box of the whole ellipse around the center
+        PointF radii = shape_points[1];
+        command.x0 -= fabsf(radii.x);
+        command.y0 -= fabsf(radii.y);
+        command.x1 += fabsf(radii.x);
+        command.y1 += fabsf(radii.y);
+    } else {
+        for (PointF p: shape_points) {
+            command.x0 = std::min(command.x0, p.x);
+            command.y0 = std::min(command.y0, p.y);
+            command.x1 = std::max(command.x1, p.x);
+            command.y1 = std::max(command.y1, p.y);
+        }
+    }
+    // pixels reach half a pixel out of the shape, strokes half of their thickness more
+    bool filled = shape == SHAPE_POLYGON || shape == SHAPE_FILLED_ELLIPSE || shape == SHAPE_FILLED_ARC;
+    float reach = (filled ? 0 : thickness/2) + 1;
+    command.x0 -= reach;
+    command.y0 -= reach;
+    command.x1 += reach;
+    command.y1 += reach;
 
-            intery = intery + gradient;
+    this->points.insert(this->points.end(), shape_points.begin(), shape_points.end());
+    this->commands.push_back(command);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::stroke_line(float x0, float y0, float x1, float y1, ColorT clr, float thickness, float k) {
+    PointF line[2] = {{x0, y0}, {x1, y1}};
+    this->add(SHAPE_LINE, line, clr, thickness, k, FILL_NONZERO);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::stroke_polyline(std::span<const PointF> polyline, ColorT clr, float thickness, float k, bool closed) {
+    this->add(closed ? SHAPE_CLOSED_POLYLINE : SHAPE_POLYLINE, polyline, clr, thickness, k, FILL_NONZERO);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::fill_polygon(std::span<const PointF> polygon, ColorT clr, float k, FillRule rule) {
+    this->add(SHAPE_POLYGON, polygon, clr, 0, k, rule);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::fill_rect(float x0, float y0, float x1, float y1, ColorT clr, float k) {
+    PointF rect[4] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}};
+    this->add(SHAPE_POLYGON, rect, clr, 0, k, FILL_NONZERO);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::stroke_rect(float x0, float y0, float x1, float y1, ColorT clr, float thickness, float k) {
+    PointF rect[4] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}};
+    this->add(SHAPE_CLOSED_POLYLINE, rect, clr, thickness, k, FILL_NONZERO);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::fill_ellipse(float cx, float cy, float rx, float ry, ColorT clr, float k) {
+    PointF ellipse[3] = {{cx, cy}, {rx, ry}, {0, 2*(float)M_PI}};
+    this->add(SHAPE_FILLED_ELLIPSE, ellipse, clr, 0, k, FILL_NONZERO);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::stroke_ellipse(float cx, float cy, float rx, float ry, ColorT clr, float thickness, float k) {
+    PointF ellipse[3] = {{cx, cy}, {rx, ry}, {0, 2*(float)M_PI}};
+    this->add(SHAPE_ELLIPSE, ellipse, clr, thickness, k, FILL_NONZERO);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::fill_circle(float cx, float cy, float radius, ColorT clr, float k) {
+    this->fill_ellipse(cx, cy, radius, radius, clr, k);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::stroke_circle(float cx, float cy, float radius, ColorT clr, float thickness, float k) {
+    this->stroke_ellipse(cx, cy, radius, radius, clr, thickness, k);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::stroke_arc(float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float thickness, float k) {
+    PointF arc[3] = {{cx, cy}, {rx, ry}, {start, end}};
+    this->add(SHAPE_ARC, arc, clr, thickness, k, FILL_NONZERO);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::fill_arc(float cx, float cy, float rx, float ry, float start, float end, ColorT clr, float k) {
+    PointF arc[3] = {{cx, cy}, {rx, ry}, {start, end}};
+    this->add(SHAPE_FILLED_ARC, arc, clr, 0, k, FILL_NONZERO);
+}
+
+template<class ColorT>
+void Canvas<ColorT>::push_clip(const ClipRect &rect) {
+    this->clips.push_back(this->clips.empty() ? rect : this->clips.back().intersection(rect));
+}
+
+template<class ColorT>
+void Canvas<ColorT>::pop_clip() {
+    if (this->clips.empty()) throw std::logic_error("Canvas::pop_clip without push_clip");
+    this->clips.pop_back();
+}
+
+template<class ColorT>
+size_t Canvas<ColorT>::size() const {
+    return this->commands.size();
+}
+
+template<class ColorT>
+void Canvas<ColorT>::clear() {
+    this->commands.clear();
+    this->points.clear();
+    this->clips.clear();
+}
+
+template<class ColorT>
+void Canvas<ColorT>::draw(ImageView img, ThreadPool &pool) const {
+    if (img.width <= 0 || img.height <= 0 || this->commands.empty()) return;
+    assert(sizeof(ColorT) == (size_t)img.pixel_size());
+
+    int tiles_x = (img.width + CANVAS_TILE_SIZE - 1)/CANVAS_TILE_SIZE;
+    int tiles_y = (img.height + CANVAS_TILE_SIZE - 1)/CANVAS_TILE_SIZE;
+    // tiles a command touches, false if it is out of the image or of its clip
+    auto tile_range = [&](const Command &command, int &tx0, int &ty0, int &tx1, int &ty1) {
+        ClipRect box = command.clip.intersection(ClipRect(img));
+        // written so that NaN is out too
+        if (box.empty() || !(command.x1 >= box.x0 && command.y1 >= box.y0 && command.x0 <= box.x1 - 1 && command.y0 <= box.y1 - 1)) return false;
+        tx0 = (int)std::max(command.x0, (float)box.x0)/CANVAS_TILE_SIZE;
+        ty0 = (int)std::max(command.y0, (float)box.y0)/CANVAS_TILE_SIZE;
+        tx1 = (int)std::min(command.x1, box.x1 - 1.0f)/CANVAS_TILE_SIZE;
+        ty1 = (int)std::min(command.y1, box.y1 - 1.0f)/CANVAS_TILE_SIZE;
+        return true;
+    };
+
+    // commands of every tile in order of submission, tile after tile: tile t has bins[offsets[t]..offsets[t + 1])
+    std::vector<uint32_t> offsets(tiles_x*tiles_y + 1, 0);
+    for (const Command &command: this->commands) {
+        int tx0, ty0, tx1, ty1;
+        if (!tile_range(command, tx0, ty0, tx1, ty1)) continue;
+        for (int ty=ty0; ty<=ty1; ty++) {
+            for (int tx=tx0; tx<=tx1; tx++) offsets[ty*tiles_x + tx + 1]++;
         }
     }
+    std::vector<int> tiles;
+    for (int t=0; t<tiles_x*tiles_y; t++) {
+        if (offsets[t + 1] > 0) tiles.push_back(t);
+        offsets[t + 1] += offsets[t];
+    }
+    std::vector<uint32_t> bins(offsets.back());
+    std::vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t i=0; i<this->commands.size(); i++) {
+        int tx0, ty0, tx1, ty1;
+        if (!tile_range(this->commands[i], tx0, ty0, tx1, ty1)) continue;
+        for (int ty=ty0; ty<=ty1; ty++) {
+            for (int tx=tx0; tx<=tx1; tx++) bins[filled[ty*tiles_x + tx]++] = i;
+        }
+    }
+
+    pool.parallel_for(tiles.size(), [&](int i) {
+        int t = tiles[i];
+        int x = (t % tiles_x)*CANVAS_TILE_SIZE, y = (t/tiles_x)*CANVAS_TILE_SIZE;
+        ClipRect tile(x, y, std::min(x + CANVAS_TILE_SIZE, img.width), std::min(y + CANVAS_TILE_SIZE, img.height));
+
+        for (uint32_t b=offsets[t]; b<offsets[t + 1]; b++) {
+            const Command &command = this->commands[bins[b]];
+            ClipRect clip = tile.intersection(command.clip);
+            std::span<const PointF> points(this->points.data() + command.first, command.count);
+            switch (command.shape) {
+                case SHAPE_LINE:
+                    ::stroke_line(img, clip, points[0].x, points[0].y, points[1].x, points[1].y, command.color, command.thickness, command.k);
+                    break;
+                case SHAPE_POLYLINE:
+                case SHAPE_CLOSED_POLYLINE:
+                    ::stroke_polyline(img, clip, points, command.color, command.thickness, command.k, command.shape == SHAPE_CLOSED_POLYLINE);
+                    break;
+                case SHAPE_POLYGON:
+                    ::fill_polygon(img, clip, points, command.color, command.k, command.rule);
+                    break;
+                case SHAPE_ELLIPSE:
+                case SHAPE_ARC:
+                    ::stroke_arc(img, clip, points[0].x, points[0].y, points[1].x, points[1].y, points[2].x, points[2].y, command.color, command.thickness, command.k);
+                    break;
+                case SHAPE_FILLED_ELLIPSE:
+                case SHAPE_FILLED_ARC:
+                    ::fill_arc(img, clip, points[0].x, points[0].y, points[1].x, points[1].y, points[2].x, points[2].y, command.color, command.k);
+                    break;
+            }
+        }
+    });
 }
 
 
@@ -0,0 +1,361 @@
+#ifndef STB_IMAGE_WRAPPER_FILTER_INCLUDE
+#define STB_IMAGE_WRAPPER_FILTER_INCLUDE
+
+#include "image.hpp"
+#include <math.h>
+#include <optional>
+#include <array>
+#include <utility>
+
+
+// Convolution kernel of odd width & height centered on the pixel: weights[ky*width + kx] multiplies pixel
+// (x + kx - width/2, y + ky - height/2). Weights are not flipped (correlation, as image filters are usually written).
+struct Kernel {
+    int width = 0, height = 0;
+    std::vector<float> weights;
+    // added to every result, e.g. 128 to show signed responses in 8-bit images
+    float bias = 0;
+    // when weights are column[ky]*row[kx] (found by the constructor), the 2 passes of the separable filter, else empty
+    std::vector<float> row, column;
+
+    Kernel() = default;
+    Kernel(int width, int height, std::vector<float> weights, float bias = 0);
+    static Kernel separable(std::span<const float> row, std::span<const float> column, float bias = 0);
+
+    bool is_separable() const { return !this->row.empty(); }
+
+    static Kernel box(int radius);
+    static Kernel sharpen();
+    static Kernel emboss();
+    static Kernel laplacian();
+    // gradients, positive where values grow to the right / down
+    static Kernel sobel_x();
+    static Kernel sobel_y();
+};
+
+// Convolves src with kernel into dst of the same size & channels, dst may be src (filter in place).
+// Pixels outside the image come from the edge mode, as in stb_image_resize2 (STBIR_EDGE_ZERO reads zeros).
+// Results are in sample units of src and are stored in dst as they are (integers rounded & clamped),
+// so F32 dst keeps signed responses like Sobel gradients. All channels are filtered, alpha too.
+// Separable kernels run as a row pass & a column pass when that saves taps (5x5 & larger);
+// zero weights are skipped, loops over up to 25 taps (any 3x3 & 5x5 kernel or pass) are unrolled at compile time.
+// The image is processed by tiles in parallel.
+void convolve(ConstImageView src, ImageView dst, const Kernel &kernel, stbir_edge edge = STBIR_EDGE_CLAMP, ThreadPool &pool = ThreadPool::shared());
+
+#endif // STB_IMAGE_WRAPPER_FILTER_INCLUDE
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+#ifdef STB_IMAGE_WRAPPER_FILTER_IMPLEMENTATION
+
+#if !defined(STB_IMAGE_WRAPPER_NO_SIMD)
+    #if defined(__AVX2__)
+        #define STB_IMAGE_WRAPPER_AVX2
+        #include <immintrin.h>
+    #elif defined(__SSE2__) || defined(_M_X64)
+        #define STB_IMAGE_WRAPPER_SSE2
+        #include <emmintrin.h>
+    #endif
+#endif
+
+// tiles are about FILTER_TILE_PIXELS wide (rings of kernel rows of a tile stay in L2)
+// & FILTER_TILE_ROWS tall (rows around a tile are read again by its neighbours)
+static const int FILTER_TILE_PIXELS = 512;
+static const int FILTER_TILE_ROWS = 64;
+// cost of a pass over a row (loads & stores of the row between passes) in taps
+static const int FILTER_PASS_TAPS = 4;
+// taps of 5x5 kernels, passes of more taps run a loop over taps
+static const int FILTER_UNROLLED_TAPS = 25;
+
+Kernel::Kernel(int width, int height, std::vector<float> weights, float bias):
+    width(width), height(height), weights(std::move(weights)), bias(bias)
+{
+    if (width < 1 || height < 1 || width % 2 == 0 || height % 2 == 0) {
+        throw std::invalid_argument("Kernel size must be odd, got " + std::to_string(width) + "x" + std::to_string(height));
+    }
+    if (this->weights.size() != (size_t)width*height) {
+        throw std::invalid_argument("Kernel of " + std::to_string(width) + "x" + std::to_string(height) + " needs "
+            + std::to_string(width*height) + " weights, got " + std::to_string(this->weights.size()));
+    }
+    // a single row or column is one pass already
+    if (width == 1 || height == 1) return;
+
+    // rank 1: every row is the row of the largest weight scaled
+    int pivot = 0;
+    for (int i=0; i<width*height; i++) {
+        if (fabsf(this->weights[i]) > fabsf(this->weights[pivot])) pivot = i;
+    }
+    float max = fabsf(this->weights[pivot]);
+    if (max == 0) return;
+    int py = pivot / width, px = pivot % width;
+
+    std::vector<float> row(width), column(height);
+    for (int kx=0; kx<width; kx++) row[kx] = this->weights[py*width + kx];
+    for (int ky=0; ky<height; ky++) column[ky] = this->weights[ky*width + px] / this->weights[pivot];
+    for (int ky=0; ky<height; ky++) {
+        for (int kx=0; kx<width; kx++) {
+            if (fabsf(column[ky]*row[kx] - this->weights[ky*width + kx]) > max*1e-6f) return;
+        }
+    }
+    this->row = std::move(row);
+    this->column = std::move(column);
+}
+
+Kernel Kernel::separable(std::span<const float> row, std::span<const float> column, float bias) {
+    std::vector<float> weights(row.size()*column.size());
+    for (size_t ky=0; ky<column.size(); ky++) {
+        for (size_t kx=0; kx<row.size(); kx++) weights[ky*row.size() + kx] = column[ky]*row[kx];
+    }
+    return Kernel(row.size(), column.size(), std::move(weights), bias);
+}
+
+Kernel Kernel::box(int radius) {
+    if (radius < 0) throw std::invalid_argument("Box kernel radius must not be negative");
+    int size = 2*radius + 1;
+    return Kernel(size, size, std::vector<float>(size*size, 1.0f/(size*size)));
+}
+
+Kernel Kernel::sharpen() {
+    return Kernel(3, 3, {0, -1, 0, -1, 5, -1, 0, -1, 0});
+}
+
+Kernel Kernel::emboss() {
+    return Kernel(3, 3, {-2, -1, 0, -1, 1, 1, 0, 1, 2});
+}
+
+Kernel Kernel::laplacian() {
+    return Kernel(3, 3, {0, 1, 0, 1, -4, 1, 0, 1, 0});
+}
+
+Kernel Kernel::sobel_x() {
+    return Kernel(3, 3, {-1, 0, 1, -2, 0, 2, -1, 0, 1});
+}
+
+Kernel Kernel::sobel_y() {
+    return Kernel(3, 3, {-1, -2, -1, 0, 0, 0, 1, 2, 1});
+}
+
+// out[i] = bias + sum of w[t]*in[t][i] over n floats. TAPS is the number of taps known at compile time
+// (the loop over taps is unrolled & weights stay in registers), 0 - taps at run time.
+// Taps go to 4 accumulators in turn, so additions do not wait for each other.
+template<int TAPS>
+static void filter_taps(const float *const *in, const float *w, int taps, float bias, float *out, int n) {
+    const int T = TAPS ? TAPS : taps;
+    int i = 0;
+#if defined(STB_IMAGE_WRAPPER_AVX2)
+    auto tap = [&](__m256 acc, int t) { return _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(w[t]), _mm256_loadu_ps(in[t] + i))); };
+    for (; i+8<=n; i+=8) {
+        __m256 a0 = _mm256_set1_ps(bias), a1 = _mm256_setzero_ps(), a2 = a1, a3 = a1;
+        int t = 0;
+        for (; t+4<=T; t+=4) {
+            a0 = tap(a0, t);
+            a1 = tap(a1, t + 1);
+            a2 = tap(a2, t + 2);
+            a3 = tap(a3, t + 3);
+        }
+        for (; t<T; t++) a0 = tap(a0, t);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_add_ps(a0, a1), _mm256_add_ps(a2, a3)));
+    }
+#elif defined(STB_IMAGE_WRAPPER_SSE2)
+    auto tap = [&](__m128 acc, int t) { return _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(w[t]), _mm_loadu_ps(in[t] + i))); };
+    for (; i+4<=n; i+=4) {
+        __m128 a0 = _mm_set1_ps(bias), a1 = _mm_setzero_ps(), a2 = a1, a3 = a1;
+        int t = 0;
+        for (; t+4<=T; t+=4) {
+            a0 = tap(a0, t);
+            a1 = tap(a1, t + 1);
+            a2 = tap(a2, t + 2);
+            a3 = tap(a3, t + 3);
+        }
+        for (; t<T; t++) a0 = tap(a0, t);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3)));
+    }
+#endif
+    for (; i<n; i++) {
+        float acc = bias;
+        for (int t=0; t<T; t++) acc += w[t]*in[t][i];
+        out[i] = acc;
+    }
+}
+
+template<int... TAPS>
+static constexpr auto filter_taps_table(std::integer_sequence<int, TAPS...>) {
+    return std::array{&filter_taps<TAPS>...};
+}
+
+// Every tap count up to FILTER_UNROLLED_TAPS has its own loop, so 3x3 & 5x5 kernels are unrolled
+// whatever number of their weights is zero (Sobel 6 taps, emboss 7, 5x5 LoG 13)
+static void filter_taps(const float *const *in, const float *w, int taps, float bias, float *out, int n) {
+    static constexpr auto table = filter_taps_table(std::make_integer_sequence<int, FILTER_UNROLLED_TAPS + 1>());
+    table[taps <= FILTER_UNROLLED_TAPS ? taps : 0](in, w, taps, bias, out, n);
+}
+
+// Source index of i outside [0, n) as stb_image_resize2 maps it, -1 for STBIR_EDGE_ZERO
+static int filter_edge(int i, int n, stbir_edge edge) {
+    if (i >= 0 && i < n) return i;
+    switch (edge) {
+    case STBIR_EDGE_CLAMP: return i < 0 ? 0 : n - 1;
+    case STBIR_EDGE_REFLECT:
+        if (i < 0) return i > -n ? -i : n - 1;
+        return i >= 2*n ? 0 : 2*n - i - 1;
+    case STBIR_EDGE_WRAP: return ((i % n) + n) % n;
+    case STBIR_EDGE_ZERO: return -1;
+    }
+    return -1;
+}
+
+// pixels [x_begin, x_end) of source row y (already mapped, -1 is a row of zeros) to floats,
+// pixels outside the image are mapped by the edge mode
+static void filter_load_segment(ConstImageView src, int y, int x_begin, int x_end, stbir_edge edge, float *out) {
+    const int C = src.channels;
+    if (y < 0) {
+        memset(out, 0, (size_t)(x_end - x_begin)*C*sizeof(float));
+        return;
+    }
+    const uint8_t *row = src.data + (size_t)y*src.stride;
+    int from = std::clamp(x_begin, 0, src.width), to = std::clamp(x_end, 0, src.width);
+    if (from < to) {
+        load_sample_row(row + (size_t)from*src.pixel_size(), src.sample, out + (size_t)(from - x_begin)*C, (to - from)*C);
+    }
+    for (int x=x_begin; x<x_end; x++) {
+        if (x >= from && x < to) x = to;
+        if (x >= x_end) break;
+        float *p = out + (size_t)(x - x_begin)*C;
+        int sx = filter_edge(x, src.width, edge);
+        if (sx < 0) memset(p, 0, C*sizeof(float));
+        else load_sample_row(row + (size_t)sx*src.pixel_size(), src.sample, p, C);
+    }
+}
+
+// Taps of a pass without zero weights: in pointers are base + offsets[t]
+struct FilterTaps {
+    std::vector<float> weights;
+    std::vector<int> rows;
+    std::vector<size_t> offsets;
+    std::vector<const float*> in;
+
+    void add(float w, int row, size_t offset) {
+        if (w == 0) return;
+        this->weights.push_back(w);
+        this->rows.push_back(row);
+        this->offsets.push_back(offset);
+        this->in.push_back(nullptr);
+    }
+};
+
+// One tile: rows [y0, y1) of columns [x0, x1), streaming the rows of the tile through a ring of the kernel height.
+// Separable kernels keep rows after the row pass in the ring, other kernels the source rows with a halo of width/2 pixels.
+struct FilterTile {
+    ConstImageView src;
+    const Kernel &kernel;
+    stbir_edge edge;
+    bool separable = false;
+    FilterTaps horizontal, vertical;
+    std::vector<float> ring, line, acc;
+
+    FilterTile(ConstImageView src, const Kernel &kernel, stbir_edge edge, int tile_width): src(src), kernel(kernel), edge(edge) {
+        const int C = src.channels;
+        const int rx = kernel.width/2;
+        size_t line_len = (size_t)(tile_width + 2*rx)*C;
+        this->line.resize(line_len);
+        this->acc.resize((size_t)tile_width*C);
+
+        FilterTaps full, row, column;
+        for (int ky=0; ky<kernel.height; ky++) {
+            for (int kx=0; kx<kernel.width; kx++) full.add(kernel.weights[ky*kernel.width + kx], ky, (size_t)kx*C);
+        }
+        if (kernel.is_separable()) {
+            for (int kx=0; kx<kernel.width; kx++) row.add(kernel.row[kx], 0, (size_t)kx*C);
+            for (int ky=0; ky<kernel.height; ky++) column.add(kernel.column[ky], ky, 0);
+            // the pass between is worth about FILTER_PASS_TAPS taps, so small kernels (3x3 & Sobel) run in one pass
+            this->separable = row.in.size() + column.in.size() + FILTER_PASS_TAPS < full.in.size();
+        }
+        if (this->separable) {
+            this->ring.resize((size_t)kernel.height*tile_width*C);
+            this->horizontal = std::move(row);
+            this->vertical = std::move(column);
+        } else {
+            this->ring.resize((size_t)kernel.height*line_len);
+            this->vertical = std::move(full);
+        }
+    }
+
+    void run(ImageView dst, int x0, int x1, int y0, int y1) {
+        const int C = this->src.channels;
+        const int KH = this->kernel.height, rx = this->kernel.width/2, ry = KH/2;
+        const bool separable = this->separable;
+        const int n = (x1 - x0)*C;
+        const size_t len = separable ? (size_t)n : (size_t)(x1 - x0 + 2*rx)*C;
+        auto slot = [&](int v) { return this->ring.data() + (size_t)(v % KH)*len; };
+
+        // ring row v is source row y0 - ry + v
+        int produced = 0;
+        for (int y=y0; y<y1; y++) {
+            int v = y - y0;
+            for (; produced<v + KH; produced++) {
+                int sy = filter_edge(y0 - ry + produced, this->src.height, this->edge);
+                if (!separable) {
+                    filter_load_segment(this->src, sy, x0 - rx, x1 + rx, this->edge, slot(produced));
+                    continue;
+                }
+                filter_load_segment(this->src, sy, x0 - rx, x1 + rx, this->edge, this->line.data());
+                FilterTaps &h = this->horizontal;
+                for (size_t t=0; t<h.in.size(); t++) h.in[t] = this->line.data() + h.offsets[t];
+                filter_taps(h.in.data(), h.weights.data(), h.in.size(), 0, slot(produced), n);
+            }
+
+            FilterTaps &taps = this->vertical;
+            for (size_t t=0; t<taps.in.size(); t++) taps.in[t] = slot(v + taps.rows[t]) + taps.offsets[t];
+            filter_taps(taps.in.data(), taps.weights.data(), taps.in.size(), this->kernel.bias, this->acc.data(), n);
+            store_sample_row(this->acc.data(), dst.data + (size_t)y*dst.stride + (size_t)x0*dst.pixel_size(), dst.sample, n);
+        }
+    }
+};
+
+void convolve(ConstImageView src, ImageView dst, const Kernel &kernel, stbir_edge edge, ThreadPool &pool) {
+    if (src.width != dst.width || src.height != dst.height || src.channels != dst.channels) {
+        throw std::invalid_argument("Convolution destination does not match source");
+    }
+    if (kernel.width < 1 || kernel.height < 1 || kernel.width % 2 == 0 || kernel.height % 2 == 0
+        || kernel.weights.size() != (size_t)kernel.width*kernel.height) {
+        throw std::invalid_argument("Invalid convolution kernel");
+    }
+    if (src.width == 0 || src.height == 0) return;
+    std::optional<Image> copy;
+    src = unaliased_source(src, dst, copy);
+
+    // tiles of equal width, row bands tall enough that rows read around them are a small part
+    int tiles_x = (src.width + FILTER_TILE_PIXELS - 1) / FILTER_TILE_PIXELS;
+    int tile_width = (src.width + tiles_x - 1) / tiles_x;
+    int tile_rows = std::max(FILTER_TILE_ROWS, 4*kernel.height);
+    int tiles_y = (src.height + tile_rows - 1) / tile_rows;
+    int tiles = tiles_x*tiles_y;
+
+    // work counted as bytes read by all taps
+    size_t bytes = (size_t)src.width*src.height*src.pixel_size()*kernel.weights.size();
+    parallel_for_ranges(tiles, bytes, [&](int begin, int end) {
+        FilterTile tile(src, kernel, edge, tile_width);
+        for (int i=begin; i<end; i++) {
+            int tx = i % tiles_x, ty = i / tiles_x;
+            tile.run(dst, tx*tile_width, std::min(src.width, (tx + 1)*tile_width),
+                ty*tile_rows, std::min(src.height, (ty + 1)*tile_rows));
+        }
+    }, pool);
+}
+
+#endif // STB_IMAGE_WRAPPER_FILTER_IMPLEMENTATION